@@ -0,0 +1,186 @@
+// Compare container-heavy workloads on the el_malloc heap against the
+// default std::allocator. Each workload runs once with std::allocator,
+// once with el::allocator and once through std::pmr with
+// el::memory_resource; times are the best of several rounds. A final
+// object churn compares new/delete, el_malloc() and el::fixed_alloc.
+//
+// usage: el_bench_containers [rounds] [items]
+//
+// el_bench_containers_new is the same program linked with el_new.o so
+// that the std columns measure global new/delete on the el_malloc heap.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "el_malloc.hpp"
+
+#define BENCH_HEAP_BYTES (512L << 20)   // heap large enough for every workload
+#define BENCH_SPAN_PAGES 16384          // 64 MiB span region for vector growth
+
+static long items = 100000;
+static volatile long sink;              // keeps results alive
+
+template <typename Alloc>
+static void vector_growth(const Alloc &alloc) {
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<long> A;
+  std::vector<long, A> vec{A(alloc)};
+  for(long i = 0; i < items; i++) {
+    vec.push_back(i);
+  }
+  sink += vec.back();
+}
+
+template <typename Alloc>
+static void map_churn(const Alloc &alloc) {
+  typedef std::pair<const long, long> P;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<P> A;
+  std::map<long, long, std::less<long>, A> map{A(alloc)};
+  for(long i = 0; i < items; i++) {
+    map[(i * 7919) % items] = i;
+  }
+  for(long i = 0; i < items; i += 2) {
+    map.erase(i);
+  }
+  for(long i = 0; i < items; i += 2) {
+    map[i] = i;
+  }
+  sink += map.size();
+}
+
+template <typename Alloc>
+static void list_shuffle(const Alloc &alloc) {
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<long> A;
+  std::list<long, A> list{A(alloc)};
+  for(long i = 0; i < items; i++) {
+    if(i % 3 == 0) {
+      list.push_front(i);
+    }
+    else {
+      list.push_back(i);
+    }
+  }
+  list.remove_if([](long x) { return x % 5 == 0; });
+  sink += list.size();
+}
+
+// std::hash only covers strings with the default allocator
+struct view_hash {
+  template <typename S>
+  size_t operator()(const S &str) const {
+    return std::hash<std::string_view>()(std::string_view(str.data(), str.size()));
+  }
+};
+
+template <typename Alloc>
+static void hash_strings(const Alloc &alloc) {
+  typedef std::basic_string<char, std::char_traits<char>,
+    typename std::allocator_traits<Alloc>::template rebind_alloc<char>> S;
+  typedef std::pair<const S, long> P;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<P> A;
+  std::unordered_map<S, long, view_hash, std::equal_to<S>, A> table{A(alloc)};
+  char buf[64];
+  for(long i = 0; i < items; i++) {
+    snprintf(buf, sizeof(buf), "key-%ld-padded-past-the-small-string-buffer", i);
+    table.emplace(S(buf, typename S::allocator_type(alloc)), i);
+  }
+  sink += table.size();
+}
+
+struct node {
+  node *next;
+  long key;
+  long val[4];
+};
+
+// Keep a window of live nodes, replacing the oldest with a new one.
+template <typename New, typename Delete>
+static void node_churn(New make, Delete drop) {
+  node *window[256] = {};
+  for(long i = 0; i < 20 * items; i++) {
+    node *&slot = window[i % 256];
+    if(slot != nullptr) {
+      sink += slot->key;
+      drop(slot);
+    }
+    slot = make();
+    slot->key = i;
+  }
+  for(node *n : window) {
+    drop(n);
+  }
+}
+
+// Run work(alloc) rounds times and return the best time in milliseconds.
+template <typename Alloc, typename Work>
+static double best_of(int rounds, const Alloc &alloc, Work work) {
+  double best = 1e30;
+  for(int r = 0; r < rounds; r++) {
+    auto start = std::chrono::steady_clock::now();
+    work(alloc);
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+    if(took.count() < best) {
+      best = took.count();
+    }
+  }
+  return best;
+}
+
+template <typename Work>
+static void bench(const char *name, int rounds, Work work) {
+  el::memory_resource res;
+  double std_ms = best_of(rounds, std::allocator<char>(), work);
+  double el_ms  = best_of(rounds, el::allocator<char>(), work);
+  double pmr_ms = best_of(rounds, std::pmr::polymorphic_allocator<char>(&res), work);
+  printf("%-14s %12.2f %12.2f %12.2f %8.2fx\n", name, std_ms, el_ms, pmr_ms, std_ms / el_ms);
+}
+
+int main(int argc, char *argv[]){
+  int rounds = argc > 1 ? atoi(argv[1]) : 5;
+  items = argc > 2 ? atol(argv[2]) : items;
+
+  // linked with el_new.o the heap already exists and holds every C++
+  // allocation, std::allocator's included, so must outlive main()
+  bool own_heap = el_ctl.heap_start == NULL;
+  if(own_heap &&
+     (el_init_size(BENCH_HEAP_BYTES) != 0 ||
+      el_mallopt(EL_OPT_TINY, 1) != 0 ||
+      el_mallopt(EL_OPT_SLAB, 1) != 0 ||
+      el_mallopt(EL_OPT_SPAN_PAGES, BENCH_SPAN_PAGES) != 0)) {
+    fprintf(stderr, "el_malloc heap setup failed\n");
+    return 1;
+  }
+
+  printf("%ld items, best of %d rounds (ms)\n", items, rounds);
+  printf("%-14s %12s %12s %12s %9s\n", "workload", "std", "el", "el pmr", "std/el");
+  bench("vector_growth", rounds, [](const auto &a) { vector_growth(a); });
+  bench("map_churn",     rounds, [](const auto &a) { map_churn(a); });
+  bench("list_shuffle",  rounds, [](const auto &a) { list_shuffle(a); });
+  bench("hash_strings",  rounds, [](const auto &a) { hash_strings(a); });
+
+  printf("\n%-14s %12s %12s %12s\n", "workload", "new", "el_malloc", "fixed_alloc");
+  int none = 0;
+  double new_ms = best_of(rounds, none, [](int) {
+    node_churn([] { return new node; }, [](node *n) { delete n; });
+  });
+  double el_ms = best_of(rounds, none, [](int) {
+    node_churn([] { return (node *) el_malloc(sizeof(node)); }, [](node *n) { el_free(n); });
+  });
+  double fixed_ms = best_of(rounds, none, [](int) {
+    typedef el::fixed_for<node> F;
+    node_churn([] { return (node *) F::allocate(); }, [](node *n) { F::deallocate(n); });
+  });
+  printf("%-14s %12.2f %12.2f %12.2f\n", "node_churn", new_ms, el_ms, fixed_ms);
+
+  if(own_heap) {
+    el_cleanup();
+  }
+  return 0;
+}
@@ -0,0 +1,283 @@
+// Run the same deterministic streams of malloc, realloc and free
+// through el_malloc and through the system malloc and compare them side
+// by side: throughput, peak and final resident memory, and
+// fragmentation, taken as the share of the resident growth at the peak
+// that live requested bytes do not account for. Each stream runs in a
+// forked child per allocator so the resident figures of one do not
+// include the other.
+//
+// Every block is filled with a byte derived from its slot and checked
+// before it is freed, and a realloc must keep the contents up to the
+// smaller size. The bytes read back are summed; the streams behave the
+// same if both allocators read back the same sum with no mismatches and
+// fail the same requests. Pointers which are not 16-byte aligned are
+// counted too since el_malloc() does not align list blocks; that is
+// reported but not a difference in behaviour. The exit status is
+// non-zero if any stream behaves differently.
+//
+// usage: el_bench_diff [ops] [seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "el_malloc.h"
+
+#define HEAP_BYTES (1L << 30)
+#define SPAN_PAGES 32768                // 128 MiB of it for medium requests
+#define MAX_SLOTS  65536
+
+typedef struct {
+    const char *name;
+    void *(*malloc)(size_t);
+    void *(*realloc)(void *, size_t);
+    void (*free)(void *);
+} allocator_t;
+
+typedef struct {
+    const char *name;
+    int slots;                          // live blocks at most
+    int realloc_pct;                    // share of operations that realloc
+    size_t (*size)(uint64_t *rng, long op, long ops);
+} workload_t;
+
+typedef struct {
+    double seconds;
+    long peak_kb;                       // resident growth at the peak
+    long final_kb;                      // resident growth after freeing everything
+    size_t live_peak;                   // most requested bytes live at once
+    uint64_t sum;                       // bytes read back
+    long mismatches;                    // bytes read back wrong
+    long failures;                      // requests returning NULL
+    long unaligned;                     // pointers not 16-byte aligned
+} result_t;
+
+static allocator_t allocators[] = {
+    {"system", malloc, realloc, free},
+    {"el", el_malloc, el_realloc, el_free},
+};
+
+static uint64_t next(uint64_t *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+// Small objects such as list and tree nodes.
+static size_t small_size(uint64_t *rng, long op, long ops) {
+    return 8 + next(rng) % 121;
+}
+
+// Sizes spread evenly over powers of two from 16 bytes to 8 KiB.
+static size_t mixed_size(uint64_t *rng, long op, long ops) {
+    int shift = 4 + next(rng) % 9;
+    return (1UL << shift) + next(rng) % (1UL << shift);
+}
+
+// Buffers resized by realloc as strings and vectors are.
+static size_t buffer_size(uint64_t *rng, long op, long ops) {
+    return 16 + next(rng) % (next(rng) % 8 == 0 ? 65536 : 1024);
+}
+
+// Small objects for the first half, then mostly larger ones which the
+// holes left by the small ones cannot hold.
+static size_t phase_size(uint64_t *rng, long op, long ops) {
+    if (op < ops / 2 || next(rng) % 4 == 0) {
+        return 16 + next(rng) % 112;
+    }
+    return 4096 + next(rng) % 61440;
+}
+
+static workload_t workloads[] = {
+    {"small",   65536,  0, small_size},
+    {"mixed",   16384, 10, mixed_size},
+    {"buffers",  4096, 50, buffer_size},
+    {"phases",  16384,  0, phase_size},
+};
+
+// Resident kilobytes of this process, or its high-water mark.
+static long rss_kb(const char *field) {
+    char line[256];
+    long kb = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            kb = atol(line + strlen(field) + 1);
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// Start the high-water mark again from the current resident size.
+static void reset_peak() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) != 1) {
+            perror("clear_refs");
+        }
+        close(fd);
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read back the n bytes at ptr, which should all be fill.
+static void check(result_t *res, const unsigned char *ptr, size_t n, unsigned char fill) {
+    for (size_t i = 0; i < n; i++) {
+        res->sum += ptr[i];
+        res->mismatches += ptr[i] != fill;
+    }
+}
+
+static void count_ptr(result_t *res, void *ptr) {
+    if (ptr == NULL) {
+        res->failures++;
+    }
+    else if ((uintptr_t) ptr % 16 != 0) {
+        res->unaligned++;
+    }
+}
+
+// Run ops operations of the workload through the allocator. Each picks
+// a slot at random: an empty slot gets a new block, a full one is
+// reallocated or freed.
+static void run(const workload_t *w, const allocator_t *a, long ops, uint64_t seed, result_t *res) {
+    static unsigned char *slot[MAX_SLOTS];
+    static size_t size[MAX_SLOTS];
+    uint64_t rng = seed;
+    size_t live = 0;
+
+    memset(slot, 0, sizeof(slot));
+    memset(res, 0, sizeof(*res));
+    long base_kb = rss_kb("VmRSS:");
+    reset_peak();
+    double start = now();
+    for (long op = 0; op < ops; op++) {
+        int i = next(&rng) % w->slots;
+        unsigned char fill = i;
+        if (slot[i] == NULL) {
+            size[i] = w->size(&rng, op, ops);
+            slot[i] = a->malloc(size[i]);
+            count_ptr(res, slot[i]);
+            if (slot[i] != NULL) {
+                memset(slot[i], fill, size[i]);
+                live += size[i];
+            }
+        }
+        else if ((int) (next(&rng) % 100) < w->realloc_pct) {
+            size_t n = w->size(&rng, op, ops);
+            unsigned char *ptr = a->realloc(slot[i], n);
+            count_ptr(res, ptr);
+            if (ptr != NULL) {
+                check(res, ptr, n < size[i] ? n : size[i], fill);
+                if (n > size[i]) {
+                    memset(ptr + size[i], fill, n - size[i]);
+                }
+                live += n - size[i];
+                slot[i] = ptr;
+                size[i] = n;
+            }
+        }
+        else {
+            check(res, slot[i], size[i], fill);
+            a->free(slot[i]);
+            live -= size[i];
+            slot[i] = NULL;
+        }
+        if (live > res->live_peak) {
+            res->live_peak = live;
+        }
+    }
+    res->peak_kb = rss_kb("VmHWM:") - base_kb;
+    for (int i = 0; i < w->slots; i++) {
+        if (slot[i] != NULL) {
+            check(res, slot[i], size[i], (unsigned char) i);
+            a->free(slot[i]);
+        }
+    }
+    res->seconds = now() - start;
+    res->final_kb = rss_kb("VmRSS:") - base_kb;
+}
+
+// Run the workload with the allocator in a child process and collect
+// its result through a pipe. Returns 0 on success.
+static int run_child(const workload_t *w, const allocator_t *a, long ops, uint64_t seed, result_t *res) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (a->malloc == el_malloc &&
+            (el_init_size(HEAP_BYTES) != 0 ||
+             el_mallopt(EL_OPT_TINY, 1) != 0 ||
+             el_mallopt(EL_OPT_SLAB, 1) != 0 ||
+             el_mallopt(EL_OPT_SPAN_PAGES, SPAN_PAGES) != 0)) {
+            _exit(1);
+        }
+        run(w, a, ops, seed, res);
+        _exit(write(fds[1], res, sizeof(*res)) == sizeof(*res) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (got != sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s/%s: child failed\n", w->name, a->name);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long ops = argc > 1 ? atol(argv[1]) : 1000000;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 88172645463325252ULL;
+    int nalloc = sizeof(allocators) / sizeof(allocators[0]);
+    int differ = 0;
+
+    printf("%ld operations per stream, seed %llu\n", ops, (unsigned long long) seed);
+    printf("%-8s %-7s %8s %10s %10s %10s %6s %9s\n", "stream", "alloc", "Mops/s",
+           "peak KiB", "final KiB", "live KiB", "frag", "unaligned");
+    for (int k = 0; k < sizeof(workloads) / sizeof(workloads[0]); k++) {
+        const workload_t *w = &workloads[k];
+        result_t res[sizeof(allocators) / sizeof(allocators[0])];
+        for (int j = 0; j < nalloc; j++) {
+            if (run_child(w, &allocators[j], ops, seed, &res[j]) != 0) {
+                return 1;
+            }
+            double frag = res[j].peak_kb > 0 ?
+                1 - res[j].live_peak / 1024.0 / res[j].peak_kb : 0;
+            printf("%-8s %-7s %8.2f %10ld %10ld %10lu %5.1f%% %9ld\n", w->name, allocators[j].name,
+                   ops / res[j].seconds / 1e6, res[j].peak_kb, res[j].final_kb,
+                   res[j].live_peak / 1024, 100 * frag, res[j].unaligned);
+        }
+        for (int j = 1; j < nalloc; j++) {
+            if (res[j].sum != res[0].sum || res[j].mismatches != 0 || res[0].mismatches != 0 ||
+                res[j].failures != res[0].failures) {
+                printf("%-8s BEHAVIOUR DIFFERS: %s read back %llu (%ld wrong, %ld failed), "
+                       "%s %llu (%ld wrong, %ld failed)\n", w->name,
+                       allocators[0].name, (unsigned long long) res[0].sum, res[0].mismatches, res[0].failures,
+                       allocators[j].name, (unsigned long long) res[j].sum, res[j].mismatches, res[j].failures);
+                differ = 1;
+            }
+        }
+    }
+    printf(differ ? "behaviour differs\n" : "behaviour matches\n");
+    return differ;
+}
@@ -0,0 +1,136 @@
+// Measure the latency of individual el_malloc() and el_free() calls on
+// a fragmented heap, once in the default mode and once in bounded-
+// latency mode (EL_OPT_REALTIME), and report percentiles and the worst
+// case of each. With a bound in nanoseconds given the real-time worst
+// cases are checked against it and the exit status says whether it
+// held. The worst cases also catch the thread being preempted, which no
+// allocator can bound, so the benchmark asks for SCHED_FIFO to keep
+// that out. Where it is refused the 99.99th percentiles are checked
+// instead, as the maxima then measure the scheduler.
+//
+// usage: el_bench_latency [ops] [bound_ns]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "el_malloc.h"
+
+#define HEAP_BYTES (64L << 20)
+#define SLOTS      16384                // live allocations kept at once
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+// Sizes are spread evenly over powers of two from 16 bytes to 8 KiB
+// so every tier and many list block sizes are in play.
+static size_t pick_size() {
+    int shift = 4 + rand() % 9;
+    return (1UL << shift) + rand() % (1UL << shift);
+}
+
+static int fifo;                        // 1 if running under SCHED_FIFO
+
+// Sort n latencies, print their summary and return the worst under
+// SCHED_FIFO and otherwise the 99.99th percentile.
+static long report(const char *what, long *lat, long n) {
+    qsort(lat, n, sizeof(long), cmp_long);
+    long sum = 0;
+    for (long i = 0; i < n; i++) {
+        sum += lat[i];
+    }
+    printf("  %-6s %8ld ops  mean %5ld  p50 %5ld  p99 %5ld  p99.9 %6ld  p99.99 %6ld  max %8ld ns\n",
+           what, n, sum / n, lat[n / 2], lat[n * 99 / 100],
+           lat[n * 999 / 1000], lat[n * 9999 / 10000], lat[n - 1]);
+    return fifo ? lat[n - 1] : lat[n * 9999 / 10000];
+}
+
+// Run ops random allocations and frees over SLOTS slots after filling
+// and thinning the heap to fragment it; returns the larger of the two
+// calls' figures from report().
+static long run(const char *mode, long ops) {
+    static void *slot[SLOTS];
+    long *malloc_lat = malloc(ops * sizeof(long));
+    long *free_lat = malloc(ops * sizeof(long));
+    long nmalloc = 0, nfree = 0;
+
+    srand(1);
+    memset(slot, 0, sizeof(slot));
+    for (int i = 0; i < SLOTS; i++) {
+        slot[i] = el_malloc(pick_size());
+    }
+    for (int i = 0; i < SLOTS; i += 2) {
+        if (slot[i] != NULL) {
+            el_free(slot[i]);
+            slot[i] = NULL;
+        }
+    }
+
+    for (long op = 0; op < ops; op++) {
+        int i = rand() % SLOTS;
+        if (slot[i] != NULL) {
+            long t0 = now_ns();
+            el_free(slot[i]);
+            free_lat[nfree++] = now_ns() - t0;
+            slot[i] = NULL;
+        }
+        else {
+            size_t size = pick_size();
+            long t0 = now_ns();
+            slot[i] = el_malloc(size);
+            malloc_lat[nmalloc++] = now_ns() - t0;
+        }
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (slot[i] != NULL) {
+            el_free(slot[i]);
+        }
+    }
+
+    printf("%s\n", mode);
+    long worst = report("malloc", malloc_lat, nmalloc);
+    long worst_free = report("free", free_lat, nfree);
+    worst = worst > worst_free ? worst : worst_free;
+    free(malloc_lat);
+    free(free_lat);
+    return worst;
+}
+
+int main(int argc, char *argv[]) {
+    long ops = argc > 1 ? atol(argv[1]) : 1000000;
+    long bound = argc > 2 ? atol(argv[2]) : 0;
+
+    struct sched_param sp = { .sched_priority = 1 };
+    fifo = sched_setscheduler(0, SCHED_FIFO, &sp) == 0;
+    if (!fifo) {
+        printf("running without SCHED_FIFO; maxima include preemption\n");
+    }
+
+    el_init_size(HEAP_BYTES);
+    el_mallopt(EL_OPT_TINY, 1);
+    el_mallopt(EL_OPT_SLAB, 1);
+    run("default mode", ops);
+
+    if (el_mallopt(EL_OPT_REALTIME, 1) != 0) {
+        perror("EL_OPT_REALTIME (mlock)");
+        return 1;
+    }
+    long worst = run("real-time mode", ops);
+    el_cleanup();
+
+    if (bound > 0) {
+        printf("bound %ld ns %s (%s %ld ns)\n", bound,
+               worst <= bound ? "held" : "EXCEEDED", fifo ? "max" : "p99.99", worst);
+        return worst <= bound ? 0 : 1;
+    }
+    return 0;
+}
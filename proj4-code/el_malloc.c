@@ -1,28 +1,371 @@
 // el_malloc.c: implementation of explicit list allocator functions.
 
+#define _GNU_SOURCE             // memfd_create()
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "el_malloc.h"
 
 // Global control functions
 
+// Number of bytes mapped after a private heap for its lists. Offset
+// links can only reach memory near the heap so the list ends are kept
+// in an el_heapmeta_t after heap_end, as for file-backed heaps.
+#ifdef EL_OFFSET_LINKS
+#define EL_LOCAL_META_BYTES EL_HEAP_META_BYTES
+#else
+#define EL_LOCAL_META_BYTES ((size_t) 0)
+#endif
+
 // Global control variable for the allocator. Must be initialized in
 // el_init().
 el_ctl_t el_ctl = {};
 
-// Create an initial block of memory for the heap using mmap(). Initialize the
-// el_ctl data structure to point at this block. The initial size/position of
-// the heap for the memory map are given in the symbols EL_HEAP_INITIAL_SIZE
-// and EL_HEAP_START_ADDRESS. Initialize the lists in el_ctl to contain a
-// single large block of available memory and no used blocks of memory.
-int el_init() {
-    void *heap = mmap(EL_HEAP_START_ADDRESS, EL_HEAP_INITIAL_SIZE,
-                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    assert(heap == EL_HEAP_START_ADDRESS);
+// Installs the fork handlers; defined with el_lock() below.
+static void el_watch_fork();
+
+// Starts or stops the maintenance thread; defined with el_free() below.
+// Its lock guards the thread's settings and is held across fork().
+static int el_defer_set(long interval_ms);
+static pthread_mutex_t el_defer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t el_defer_wake = PTHREAD_COND_INITIALIZER;
+
+// Shard whose lock the calling thread holds while it works on that
+// shard's lists; NULL while it works on el_ctl's, which are shard 0's.
+// The list routines find their lists through el_avail_list() and
+// el_used_list() so they serve any shard.
+static __thread el_shard_t *el_cur_shard;
+
+static inline el_blocklist_t *el_avail_list() {
+    return el_cur_shard != NULL ? el_cur_shard->avail : el_ctl.avail;
+}
+
+static inline el_blocklist_t *el_used_list() {
+    return el_cur_shard != NULL ? el_cur_shard->used : el_ctl.used;
+}
+
+
+// Available-size index
+
+// Find the highest index i < count with sizes[i] >= need, or -1 if
+// there is none. Entries are appended as blocks are added to the front
+// of the available list so scanning down from the top visits blocks in
+// list order. Several versions follow; el_init_size() picks the best
+// one the CPU supports.
+typedef long (*el_scan_fn)(const size_t *sizes, size_t count, size_t need);
+
+static long el_scan_sizes_scalar(const size_t *sizes, size_t count, size_t need) {
+    for (size_t i = count; i > 0; i--) {
+        if (sizes[i-1] >= need) {
+            return i-1;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__)
+// SSE4.2 version comparing 2 sizes per instruction. Sizes are well
+// under 2^63 so the signed 64-bit compares are safe.
+__attribute__((target("sse4.2")))
+static long el_scan_sizes_sse42(const size_t *sizes, size_t count, size_t need) {
+    __m128i key = _mm_set1_epi64x((long long) need - 1);
+    size_t i = count;
+    while (i >= 4) {
+        i -= 4;
+        __m128i lo = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i *) (sizes + i)), key);
+        __m128i hi = _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i *) (sizes + i + 2)), key);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) |
+                   (_mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+        if (mask) {
+            return i + 31 - __builtin_clz(mask);  // highest matching lane
+        }
+    }
+    return el_scan_sizes_scalar(sizes, i, need);
+}
+
+// AVX2 version comparing 4 sizes per instruction, 8 per iteration.
+__attribute__((target("avx2")))
+static long el_scan_sizes_avx2(const size_t *sizes, size_t count, size_t need) {
+    __m256i key = _mm256_set1_epi64x((long long) need - 1);
+    size_t i = count;
+    while (i >= 8) {
+        i -= 8;
+        __m256i lo = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *) (sizes + i)), key);
+        __m256i hi = _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *) (sizes + i + 4)), key);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo)) |
+                   (_mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4);
+        if (mask) {
+            return i + 31 - __builtin_clz(mask);  // highest matching lane
+        }
+    }
+    return el_scan_sizes_scalar(sizes, i, need);
+}
+#endif
+
+static el_scan_fn el_scan_sizes = el_scan_sizes_scalar;
+
+// Number of size_t-sized words per entry of the index: its size, its
+// block, and the slot map entry for one EL_BLOCK_OVERHEAD stretch of
+// the heap.
+#define EL_INDEX_WORDS 3
+
+// Slot map position of block: headers are at least EL_BLOCK_OVERHEAD
+// bytes apart so each block gets its own.
+#define EL_INDEX_SLOT(block) (PTR_MINUS_PTR(block, el_ctl.heap_start) / EL_BLOCK_OVERHEAD)
+
+// Create an empty size index able to track every available block a
+// heap of heap_bytes could hold and pick the scan routine for this
+// CPU. The arrays are reserved up front but only the pages in use are
+// ever touched.
+static void el_index_init(size_t heap_bytes) {
+    el_sizeindex_t *index = &el_ctl.avail_index;
+    index->capacity = heap_bytes / EL_BLOCK_OVERHEAD + 1;
+    index->count = 0;
+    index->removed = 0;
+    index->sizes = mmap(NULL, index->capacity * EL_INDEX_WORDS * sizeof(size_t),
+                        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (index->sizes == MAP_FAILED) {
+        index->sizes = NULL;   // run without the index
+        return;
+    }
+    index->blocks = PTR_PLUS_BYTES(index->sizes, index->capacity * sizeof(size_t));
+    index->slot_of = PTR_PLUS_BYTES(index->blocks, index->capacity * sizeof(el_blockhead_t *));
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        el_scan_sizes = el_scan_sizes_avx2;
+    }
+    else if (__builtin_cpu_supports("sse4.2")) {
+        el_scan_sizes = el_scan_sizes_sse42;
+    }
+#endif
+}
+
+// Release the size index, if any.
+static void el_index_free() {
+    el_sizeindex_t *index = &el_ctl.avail_index;
+    if (index->sizes != NULL) {
+        munmap(index->sizes, index->capacity * EL_INDEX_WORDS * sizeof(size_t));
+        index->sizes = NULL;
+    }
+}
+
+// Record that block was added to the front of the available list.
+static void el_index_add(el_blockhead_t *block) {
+    el_sizeindex_t *index = &el_ctl.avail_index;
+    index->sizes[index->count] = block->size;
+    index->blocks[index->count] = block;
+    index->slot_of[EL_INDEX_SLOT(block)] = index->count;
+    index->count++;
+}
+
+// Squeeze the removed entries out of the index, keeping the rest in
+// list order.
+static void el_index_compact() {
+    el_sizeindex_t *index = &el_ctl.avail_index;
+    size_t j = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->blocks[i] != NULL) {
+            index->sizes[j] = index->sizes[i];
+            index->blocks[j] = index->blocks[i];
+            index->slot_of[EL_INDEX_SLOT(index->blocks[j])] = j;
+            j++;
+        }
+    }
+    index->count = j;
+    index->removed = 0;
+}
+
+// Record that block was removed from the available list. Its entry is
+// found through the slot map and zeroed in place, which no scan can
+// match, so removal takes constant time. Removed entries at the end
+// are dropped at once; the rest are squeezed out once they make up
+// half the index, which keeps both removal and scans linear in the
+// number of available blocks overall.
+static void el_index_remove(el_blockhead_t *block) {
+    el_sizeindex_t *index = &el_ctl.avail_index;
+    size_t i = index->slot_of[EL_INDEX_SLOT(block)];
+    assert(i < index->count && index->blocks[i] == block);
+    index->sizes[i] = 0;
+    index->blocks[i] = NULL;
+    index->removed++;
+    while (index->count > 0 && index->blocks[index->count-1] == NULL) {
+        index->count--;
+        index->removed--;
+    }
+    if (index->removed > index->count / 2) {
+        el_index_compact();
+    }
+}
+
+
+// Real-time bins
+
+// Links of a binned available block, kept at the start of its payload.
+typedef struct {
+    el_blockhead_t *next;
+    el_blockhead_t *prev;
+} el_rtlink_t;
+
+#define EL_RT_LINK(block) ((el_rtlink_t *) PTR_PLUS_BYTES(block, sizeof(el_blockhead_t)))
+
+// Map a size of at least EL_RT_MIN_SIZE to its bin: the first level is
+// the power of two below it and the second the EL_RT_SL_BITS bits after
+// its top bit.
+static void el_rt_mapping(size_t size, int *fl, int *sl) {
+    *fl = 63 - __builtin_clzl(size);
+    *sl = (size >> (*fl - EL_RT_SL_BITS)) & (EL_RT_SL_COUNT - 1);
+}
+
+// Put an available block in its bin. Blocks too small to hold the links
+// are left out; they still merge with their neighbours when those are
+// freed.
+static void el_rt_insert(el_blockhead_t *block) {
+    el_rtbins_t *rt = &el_ctl.rt_bins;
+    if (block->size < EL_RT_MIN_SIZE) {
+        return;
+    }
+    int fl, sl;
+    el_rt_mapping(block->size, &fl, &sl);
+    el_blockhead_t *head = rt->bins[fl][sl];
+    EL_RT_LINK(block)->next = head;
+    EL_RT_LINK(block)->prev = NULL;
+    if (head != NULL) {
+        EL_RT_LINK(head)->prev = block;
+    }
+    rt->bins[fl][sl] = block;
+    rt->fl_bitmap |= 1UL << fl;
+    rt->sl_bitmap[fl] |= 1U << sl;
+}
+
+// Take an available block out of its bin.
+static void el_rt_remove(el_blockhead_t *block) {
+    el_rtbins_t *rt = &el_ctl.rt_bins;
+    if (block->size < EL_RT_MIN_SIZE) {
+        return;
+    }
+    int fl, sl;
+    el_rt_mapping(block->size, &fl, &sl);
+    el_rtlink_t *link = EL_RT_LINK(block);
+    if (link->prev != NULL) {
+        EL_RT_LINK(link->prev)->next = link->next;
+    }
+    else {
+        rt->bins[fl][sl] = link->next;
+    }
+    if (link->next != NULL) {
+        EL_RT_LINK(link->next)->prev = link->prev;
+    }
+    if (rt->bins[fl][sl] == NULL) {
+        rt->sl_bitmap[fl] &= ~(1U << sl);
+        if (rt->sl_bitmap[fl] == 0) {
+            rt->fl_bitmap &= ~(1UL << fl);
+        }
+    }
+}
+
+// Return an available block of at least need bytes or NULL. The need is
+// rounded up to the next bin boundary so that any block of the first
+// non-empty bin from there fits; two bitmap lookups find that bin.
+static el_blockhead_t *el_rt_find(size_t need) {
+    el_rtbins_t *rt = &el_ctl.rt_bins;
+    if (need < EL_RT_MIN_SIZE) {
+        need = EL_RT_MIN_SIZE;
+    }
+    need += (1UL << (63 - __builtin_clzl(need) - EL_RT_SL_BITS)) - 1;
+    int fl, sl;
+    el_rt_mapping(need, &fl, &sl);
+    uint32_t sl_bits = rt->sl_bitmap[fl] & (~0U << sl);
+    if (sl_bits == 0) {
+        uint64_t fl_bits = fl == 63 ? 0 : rt->fl_bitmap & (~0UL << (fl + 1));
+        if (fl_bits == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctzl(fl_bits);
+        sl_bits = rt->sl_bitmap[fl];
+    }
+    return rt->bins[fl][__builtin_ctz(sl_bits)];
+}
+
+// Page radix map
+
+// Return the leaf slot of the radix map for the page holding addr. If
+// create is set missing nodes are made, otherwise NULL is returned when
+// the page has never been registered.
+static el_pageent_t *el_radix_slot(void *addr, int create) {
+    size_t page = (size_t) addr / EL_PAGE_SIZE;
+    if (page >> (3 * EL_RADIX_BITS) != 0) {
+        return NULL;            // beyond the 48-bit address space
+    }
+    size_t mask = EL_RADIX_FANOUT - 1;
+    void **node = (void **) &el_ctl.radix;
+    for (int level = 2; level >= 1; level--) {
+        if (*node == NULL) {
+            if (!create) {
+                return NULL;
+            }
+            // nodes are zero filled so every entry starts as EL_PAGE_NONE
+            void *fresh = mmap(NULL, EL_RADIX_FANOUT * sizeof(void *), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            assert(fresh != MAP_FAILED);
+            *node = fresh;
+        }
+        node = &((void **) *node)[(page >> (level * EL_RADIX_BITS)) & mask];
+    }
+    if (*node == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        void *fresh = mmap(NULL, EL_RADIX_FANOUT * sizeof(el_pageent_t), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(fresh != MAP_FAILED);
+        *node = fresh;
+    }
+    return &((el_pageent_t *) *node)[page & mask];
+}
+
+// Return the radix map entry for the page holding addr.
+static el_pageent_t el_radix_get(void *addr) {
+    el_pageent_t *slot = el_radix_slot(addr, 0);
+    return slot == NULL ? EL_PAGE_NONE : *slot;
+}
+
+// Set the radix map entry of the npages pages starting at the page
+// holding addr to ent.
+static void el_radix_set(void *addr, size_t npages, el_pageent_t ent) {
+    for (size_t i = 0; i < npages; i++) {
+        *el_radix_slot(PTR_PLUS_BYTES(addr, i * EL_PAGE_SIZE), 1) = ent;
+    }
+}
 
-    el_ctl.heap_bytes = EL_HEAP_INITIAL_SIZE; // make the heap as big as possible to begin with
+// Return 1 if ptr lies in memory managed by the allocator and 0
+// otherwise; a pointer can be checked before passing it to el_free()
+// when it may have come from another allocator.
+int el_owns(void *ptr) {
+    return el_radix_get(ptr) != EL_PAGE_NONE;
+}
+
+// Lay out an empty heap in the heap_bytes of memory starting at
+// heap. Fills in the el_ctl addresses, initializes the given lists
+// and makes them the available/used lists, then establishes a single
+// available block spanning the whole heap.
+static int el_format_heap(void *heap, size_t heap_bytes,
+                          el_blocklist_t *avail, el_blocklist_t *used) {
+    el_ctl.heap_bytes = heap_bytes;
     el_ctl.heap_start = heap; // set addresses of start and end of heap
     el_ctl.heap_end = PTR_PLUS_BYTES(heap, el_ctl.heap_bytes);
 
@@ -31,11 +374,18 @@ int el_init() {
                 el_ctl.heap_bytes,EL_BLOCK_OVERHEAD);
         return -1;
     }
+#ifdef EL_OFFSET_LINKS
+    if (el_ctl.heap_bytes + EL_HEAP_META_BYTES > EL_NULL_LINK) {
+        fprintf(stderr,"el_init: heap size %ld too large for 32-bit offset links\n",
+                el_ctl.heap_bytes);
+        return -1;
+    }
+#endif
 
-    el_init_blocklist(&el_ctl.avail_actual);
-    el_init_blocklist(&el_ctl.used_actual);
-    el_ctl.avail = &el_ctl.avail_actual;
-    el_ctl.used = &el_ctl.used_actual;
+    el_init_blocklist(avail);
+    el_init_blocklist(used);
+    el_ctl.avail = avail;
+    el_ctl.used = used;
 
     // establish the first available block by filling in size in
     // block/foot and null links in head
@@ -49,11 +399,366 @@ int el_init() {
     return 0;
 }
 
-// Clean up the heap area associated with the system
+// Create an initial block of memory for the heap using mmap(). Initialize the
+// el_ctl data structure to point at this block. The initial size/position of
+// the heap for the memory map are given in the symbols EL_HEAP_INITIAL_SIZE
+// and EL_HEAP_START_ADDRESS. Initialize the lists in el_ctl to contain a
+// single large block of available memory and no used blocks of memory.
+int el_init() {
+    return el_init_size(EL_HEAP_INITIAL_SIZE);
+}
+
+// Same as el_init() but the heap is heap_bytes large rather than
+// EL_HEAP_INITIAL_SIZE.
+int el_init_size(size_t heap_bytes) {
+    void *heap = mmap(EL_HEAP_START_ADDRESS, heap_bytes + EL_LOCAL_META_BYTES,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(heap == EL_HEAP_START_ADDRESS);
+
+    el_ctl.meta = NULL;
+    el_ctl.heap_shared = 0;
+    pthread_mutex_init(&el_ctl.lock_actual, NULL);
+    el_ctl.lock = &el_ctl.lock_actual;
+    el_watch_fork();
+    el_index_init(heap_bytes);
+    el_radix_set(heap, (heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE, EL_PAGE_LIST);
+#ifdef EL_OFFSET_LINKS
+    el_heapmeta_t *meta = PTR_PLUS_BYTES(heap, heap_bytes);
+    return el_format_heap(heap, heap_bytes, &meta->avail_actual, &meta->used_actual);
+#else
+    return el_format_heap(heap, heap_bytes, &el_ctl.avail_actual, &el_ctl.used_actual);
+#endif
+}
+
+// Rebuild the available and used lists from scratch by walking the
+// boundary tags of every block from heap_start to heap_end. Used to
+// recover a file-backed heap that was not closed cleanly: the blocks
+// themselves are intact but the list links may be mid-update. Adjacent
+// available blocks are merged as they are found.
+static void el_rebuild_lists() {
+    el_init_blocklist(el_ctl.avail);
+    el_init_blocklist(el_ctl.used);
+    el_blockhead_t *prev = NULL;
+    for (el_blockhead_t *block = el_ctl.heap_start; block != NULL;
+         block = el_block_above(block)) {
+        if (block->state == EL_AVAILABLE) {
+            el_add_block_front(el_ctl.avail, block);
+            if (prev != NULL && prev->state == EL_AVAILABLE) {
+                el_merge_block_with_above(prev); // prev absorbs block
+                block = prev;
+            }
+        }
+        else {
+            if (block->state != EL_USED_HANDLE) {
+                block->state = EL_USED;
+            }
+            el_add_block_front(el_ctl.used, block);
+        }
+        prev = block;
+    }
+}
+
+// Initialize the lock in a heap's metadata so that it can be shared
+// between processes and recovers if its owner dies while holding it.
+static void el_init_shared_lock(pthread_mutex_t *lock) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Map the heap held in the open file descriptor fd at
+// EL_HEAP_START_ADDRESS and make it the current heap. Used by both
+// el_init_file() and el_init_shared(); name is only used in error
+// messages. The caller holds an flock() on fd so that only one
+// process formats a new heap. An empty file is sized to hold
+// heap_bytes (rounded up to a whole page) followed by an
+// el_heapmeta_t and formatted like el_init(). An existing heap keeps
+// its original size and heap_bytes is ignored. Returns 0 on success
+// and -1 on failure; fd is closed on failure.
+static int el_attach_fd(int fd, size_t heap_bytes, const char *name, int shared) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("el_attach_fd: fstat");
+        close(fd);
+        return -1;
+    }
+
+    int fresh = (st.st_size == 0);
+    size_t map_bytes;
+    if (fresh) {
+        heap_bytes = ((heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) * EL_PAGE_SIZE;
+        map_bytes = heap_bytes + EL_HEAP_META_BYTES;
+        if (ftruncate(fd, map_bytes) < 0) {
+            perror("el_attach_fd: ftruncate");
+            close(fd);
+            return -1;
+        }
+    }
+    else {
+        map_bytes = st.st_size;
+        if (map_bytes <= EL_HEAP_META_BYTES) {
+            fprintf(stderr,"el_attach_fd: %s is too small to be a heap\n", name);
+            close(fd);
+            return -1;
+        }
+        heap_bytes = map_bytes - EL_HEAP_META_BYTES;
+    }
+
+    void *heap = mmap(EL_HEAP_START_ADDRESS, map_bytes,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#ifdef EL_OFFSET_LINKS
+    // links are relative to heap_start so any address will do
+    if (heap == MAP_FAILED) {
+#else
+    if (heap != EL_HEAP_START_ADDRESS) {
+#endif
+        fprintf(stderr,"el_attach_fd: could not map %s at %p\n", name, EL_HEAP_START_ADDRESS);
+        if (heap != MAP_FAILED) {
+            munmap(heap, map_bytes);
+        }
+        close(fd);
+        return -1;
+    }
+
+    el_heapmeta_t *meta = PTR_PLUS_BYTES(heap, heap_bytes);
+    if (!fresh && (meta->magic != EL_HEAP_MAGIC || meta->heap_bytes != heap_bytes)) {
+        fprintf(stderr,"el_attach_fd: %s is not a heap\n", name);
+        munmap(heap, map_bytes);
+        close(fd);
+        return -1;
+    }
+
+    // the size index is private to a process so cannot be kept in step
+    // with a heap that others may change; file-backed heaps go without.
+    // Only now that the mapping is known good is any index of the heap
+    // set up before given back.
+    el_index_free();
+    if (fresh) {
+        if (el_format_heap(heap, heap_bytes, &meta->avail_actual, &meta->used_actual) != 0) {
+            munmap(heap, map_bytes);
+            close(fd);
+            return -1;
+        }
+        el_init_shared_lock(&meta->lock);
+        meta->heap_bytes = heap_bytes;
+        meta->magic = EL_HEAP_MAGIC;
+    }
+    else {
+        el_ctl.heap_bytes = heap_bytes;
+        el_ctl.heap_start = heap;
+        el_ctl.heap_end = PTR_PLUS_BYTES(heap, heap_bytes);
+        // the lists' links to their end nodes are offsets if the mapping
+        // may move so nothing in meta is rewritten for this process
+        el_ctl.avail = &meta->avail_actual;
+        el_ctl.used = &meta->used_actual;
+        if (!shared) {
+            // sole user of the file: any lock state left behind by an
+            // earlier process is stale
+            el_init_shared_lock(&meta->lock);
+            if (!meta->clean) {
+                el_rebuild_lists();
+            }
+        }
+    }
+
+    meta->clean = 0;
+    el_ctl.meta = meta;
+    el_ctl.heap_fd = fd;
+    el_ctl.heap_shared = shared;
+    el_ctl.lock = &meta->lock;
+    el_watch_fork();
+    el_radix_set(heap, heap_bytes / EL_PAGE_SIZE, EL_PAGE_LIST);
+    return 0;
+}
+
+// Create or reopen a heap backed by the file at path. The file is
+// mapped shared at EL_HEAP_START_ADDRESS so that all changes to the
+// heap reach the file (when built with EL_OFFSET_LINKS the file may be
+// mapped at any address). A new file is formatted with heap_bytes of
+// heap. An existing heap file keeps its original size: if it was
+// closed by el_cleanup() it is attached as-is, otherwise the lists are
+// rebuilt from the boundary tags. Returns 0 on success and -1 on
+// failure.
+int el_init_file(const char *path, size_t heap_bytes) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("el_init_file: open");
+        return -1;
+    }
+    flock(fd, LOCK_EX);
+    int ret = el_attach_fd(fd, heap_bytes, path, 0);
+    if (ret == 0) {
+        flock(fd, LOCK_UN);
+    }
+    return ret;
+}
+
+// Create or join a heap shared between processes. name is a POSIX
+// shared memory object name such as "/myheap" passed to shm_open();
+// the first process to open it formats a heap of heap_bytes and later
+// ones attach to it. If name is NULL an anonymous memfd_create() heap
+// is made which is shared with children created by fork(). The heap is
+// mapped at EL_HEAP_START_ADDRESS in every process and all allocation
+// state lives inside it, guarded by a process-shared robust mutex: if
+// a process dies while holding it the next locker rebuilds the lists
+// from the boundary tags. The shared memory object persists until
+// removed with shm_unlink(). Returns 0 on success and -1 on failure.
+int el_init_shared(const char *name, size_t heap_bytes) {
+    int fd;
+    if (name == NULL) {
+        fd = memfd_create("el_heap", 0);
+        name = "memfd heap";
+    }
+    else {
+        fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    }
+    if (fd < 0) {
+        perror("el_init_shared");
+        return -1;
+    }
+    flock(fd, LOCK_EX);
+    int ret = el_attach_fd(fd, heap_bytes, name, 1);
+    if (ret == 0) {
+        flock(fd, LOCK_UN);
+    }
+    return ret;
+}
+
+// Bytes of the bitmap of released pages for a heap of heap_bytes.
+static size_t el_purged_bytes(size_t heap_bytes) {
+    size_t npages = (heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE;
+    return (npages + 63) / 64 * sizeof(unsigned long);
+}
+
+// Clean up the heap area associated with the system. A file-backed
+// heap is marked clean and flushed to its file before being unmapped;
+// a shared heap is only unmapped as other processes may still use it.
 void el_cleanup() {
-    munmap(el_ctl.heap_start, el_ctl.heap_bytes);
+    el_defer_set(0);
+    el_radix_set(el_ctl.heap_start, (el_ctl.heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE,
+                 EL_PAGE_NONE);
+    if (el_ctl.meta != NULL) {
+        if (!el_ctl.heap_shared) {
+            el_ctl.meta->clean = 1;
+            msync(el_ctl.heap_start, el_ctl.heap_bytes + EL_HEAP_META_BYTES, MS_SYNC);
+        }
+        munmap(el_ctl.heap_start, el_ctl.heap_bytes + EL_HEAP_META_BYTES);
+        close(el_ctl.heap_fd);
+        el_ctl.meta = NULL;
+    }
+    else {
+        munmap(el_ctl.heap_start, el_ctl.heap_bytes + EL_LOCAL_META_BYTES);
+        el_index_free();
+    }
     el_ctl.heap_start = NULL;
     el_ctl.heap_end = NULL;
+    el_ctl.lock = &el_ctl.lock_actual;
+    el_ctl.epoch++;
+    el_ctl.budget.in_use = 0;
+    el_ctl.budget.peak = 0;
+    memset(el_ctl.handles, 0, sizeof(el_ctl.handles));
+    el_ctl.rt_enabled = 0;
+    el_ctl.slab_enabled = 0;
+    el_ctl.slab_runs = 0;
+    el_ctl.slab_all = NULL;
+    memset(el_ctl.slab_partial, 0, sizeof(el_ctl.slab_partial));
+    memset(el_ctl.slab_empty, 0, sizeof(el_ctl.slab_empty));
+    memset(el_ctl.slab_sizes, 0, sizeof(el_ctl.slab_sizes));
+    memset(el_ctl.slab_hist, 0, sizeof(el_ctl.slab_hist));
+    el_ctl.slab_tune_count = 0;
+    el_ctl.slab_retunes = 0;
+    el_ctl.tiny_enabled = 0;
+    el_ctl.tiny_all = NULL;
+    memset(el_ctl.tiny_partial, 0, sizeof(el_ctl.tiny_partial));
+    memset(el_ctl.tiny_empty, 0, sizeof(el_ctl.tiny_empty));
+    el_ctl.spans.pages = NULL;
+    el_ctl.nshards = 0;
+    el_ctl.shard_bytes = 0;
+    memset(&el_ctl.defer, 0, sizeof(el_ctl.defer));
+    el_ctl.free_buffer = 0;
+    if (el_ctl.purged != NULL) {
+        munmap(el_ctl.purged, el_purged_bytes(el_ctl.heap_bytes));
+        el_ctl.purged = NULL;
+    }
+}
+
+// Acquire the lock guarding the heap. If the lock is a shared one whose
+// previous owner died mid-update, the lists may be inconsistent so they
+// are rebuilt from the boundary tags before the lock is marked
+// consistent again.
+static void el_lock() {
+    if (pthread_mutex_lock(el_ctl.lock) == EOWNERDEAD) {
+        el_rebuild_lists();
+        pthread_mutex_consistent(el_ctl.lock);
+    }
+}
+
+// Release the lock guarding the heap.
+static void el_unlock() {
+    pthread_mutex_unlock(el_ctl.lock);
+}
+
+// Fork handlers. A fork while another thread holds the heap lock would
+// leave the child's copy of the lock held by a thread that does not
+// exist there, so the forking thread takes the lock first; the heap is
+// then quiescent in both processes when fork() returns. The parent
+// simply releases it. In the child the private lock is initialized
+// afresh, but a shared heap's lock lives in memory the child shares
+// with its parent so the parent's release covers both. Objects cached
+// by other threads (fixed_alloc lists in el_malloc.hpp) cannot be
+// reached in the child and are discarded with those threads; their
+// blocks stay allocated in the child's copy of a private heap. The
+// locks of any shards are taken after the heap lock, in shard order,
+// and treated the same way. The lock of the maintenance thread's
+// settings is taken before all of them as el_defer_set() may hold it
+// while it starts the thread.
+static void el_fork_prepare() {
+    pthread_mutex_lock(&el_defer_lock);
+    if (el_ctl.heap_start != NULL) {
+        el_lock();
+        for (int k = 1; k < el_ctl.nshards; k++) {
+            pthread_mutex_lock(&el_ctl.shards[k].lock);
+        }
+    }
+}
+
+static void el_fork_parent() {
+    if (el_ctl.heap_start != NULL) {
+        for (int k = el_ctl.nshards - 1; k >= 1; k--) {
+            pthread_mutex_unlock(&el_ctl.shards[k].lock);
+        }
+        el_unlock();
+    }
+    pthread_mutex_unlock(&el_defer_lock);
+}
+
+static void el_fork_child() {
+    if (el_ctl.heap_start != NULL && el_ctl.lock == &el_ctl.lock_actual) {
+        pthread_mutex_init(&el_ctl.lock_actual, NULL);
+        for (int k = 1; k < el_ctl.nshards; k++) {
+            pthread_mutex_init(&el_ctl.shards[k].lock, NULL);
+        }
+    }
+    // the maintenance thread is not copied into the child; its frees
+    // stay queued until an allocation fails
+    pthread_mutex_init(&el_defer_lock, NULL);
+    pthread_cond_init(&el_defer_wake, NULL);
+    el_ctl.defer.interval_ms = 0;
+    el_ctl.defer.pushing = 0;
+}
+
+static pthread_once_t el_fork_once = PTHREAD_ONCE_INIT;
+
+static void el_install_fork_handlers() {
+    pthread_atfork(el_fork_prepare, el_fork_parent, el_fork_child);
+}
+
+// Install the fork handlers the first time a heap is set up.
+static void el_watch_fork() {
+    pthread_once(&el_fork_once, el_install_fork_handlers);
 }
 
 // Pointer arithmetic functions to access adjacent headers/footers
@@ -135,10 +840,10 @@ el_blockhead_t *el_block_below(el_blockhead_t *block){
 // relies on a consistent mmap() starting point for the heap.
 void el_print_blocklist(el_blocklist_t *list) {
     printf("{length: %3lu  bytes: %5lu}\n", list->length, list->bytes);
-    el_blockhead_t *block = list->beg;
+    el_blockhead_t *block = el_list_beg(list);
     for (int i=0 ; i < list->length; i++) {
         printf("  ");
-        block = block->next;
+        block = el_block_next(block);
         printf("[%3d] head @ %p ", i, block);
         printf("{state: %c  size: %5lu}\n", block->state, block->size);
         el_blockfoot_t *foot = el_get_footer(block);
@@ -180,19 +885,18 @@ void el_print_stats() {
 }
 
 // Initialize the specified list to be empty. Sets the beg/end
-// pointers to the actual space and initializes those data to be the
+// links to the actual space and initializes those data to be the
 // ends of the list. Initializes length and size to 0.
 void el_init_blocklist(el_blocklist_t *list) {
-    list->beg = &(list->beg_actual);
-    list->beg->state = EL_BEGIN_BLOCK;
-    list->beg->size = EL_UNINITIALIZED;
-    list->end = &(list->end_actual);
-    list->end->state = EL_END_BLOCK;
-    list->end->size = EL_UNINITIALIZED;
-    list->beg->next = list->end;
-    list->beg->prev = NULL;
-    list->end->next = NULL;
-    list->end->prev = list->beg;
+    el_list_set_ends(list);
+    list->beg_actual.state = EL_BEGIN_BLOCK;
+    list->beg_actual.size = EL_UNINITIALIZED;
+    list->end_actual.state = EL_END_BLOCK;
+    list->end_actual.size = EL_UNINITIALIZED;
+    el_block_set_next(el_list_beg(list), el_list_end(list));
+    el_block_set_prev(el_list_beg(list), NULL);
+    el_block_set_next(el_list_end(list), NULL);
+    el_block_set_prev(el_list_end(list), el_list_beg(list));
     list->length = 0;
     list->bytes = 0;
 }
@@ -203,16 +907,24 @@ void el_init_blocklist(el_blocklist_t *list) {
 // updated to include the new block's size and its overhead.
 void el_add_block_front(el_blocklist_t *list, el_blockhead_t *block){
    // Add the new block at the front of the list
-   block->next = list->beg->next;
-   block->prev = list->beg;
+   el_block_set_next(block, el_block_next(el_list_beg(list)));
+   el_block_set_prev(block, el_list_beg(list));
 
    // Update the list pointers to include the new block
-   list->beg->next->prev = block;
-   list->beg->next = block;
+   el_block_set_prev(el_block_next(el_list_beg(list)), block);
+   el_block_set_next(el_list_beg(list), block);
 
    // Update list metadata: increase block count and total bytes
    list->length++;
    list->bytes += block->size + EL_BLOCK_OVERHEAD; 
+
+   // Keep the size index or real-time bins in step with the available list
+   if (list == el_ctl.avail && el_ctl.avail_index.sizes != NULL) {
+     el_index_add(block);
+   }
+   else if (list == el_ctl.avail && el_ctl.rt_enabled) {
+     el_rt_insert(block);
+   }
 }
 
 
@@ -221,20 +933,28 @@ void el_add_block_front(el_blocklist_t *list, el_blockhead_t *block){
 // Updates the length and bytes for that list including
 // the EL_BLOCK_OVERHEAD bytes associated with header/footer.
 void el_remove_block(el_blocklist_t *list, el_blockhead_t *block){
-  el_blockhead_t *next_block = block->next;
-  el_blockhead_t *prev_block = block->prev;
+  el_blockhead_t *next_block = el_block_next(block);
+  el_blockhead_t *prev_block = el_block_prev(block);
 
   // Adjust pointers to remove the block from the list
   if (next_block != NULL) {
-    next_block->prev = prev_block;
+    el_block_set_prev(next_block, prev_block);
   }
   if (prev_block != NULL) {
-    prev_block->next = next_block;
+    el_block_set_next(prev_block, next_block);
   }
 
   // Update list metadata: decrement block count and bytes
   list->length--;
   list->bytes -= (block->size + EL_BLOCK_OVERHEAD);
+
+  // Keep the size index or real-time bins in step with the available list
+  if (list == el_ctl.avail && el_ctl.avail_index.sizes != NULL) {
+    el_index_remove(block);
+  }
+  else if (list == el_ctl.avail && el_ctl.rt_enabled) {
+    el_rt_remove(block);
+  }
 }
 
 
@@ -247,17 +967,32 @@ void el_remove_block(el_blocklist_t *list, el_blockhead_t *block){
 // routine may be used to find an available block to split: splitting
 // requires adding in a new header/footer. Returns a pointer to the
 // found block or NULL if no of sufficient size is available.
+//
+// When the size index is present the sizes are scanned there instead,
+// which visits the blocks in the same order without touching each
+// block's header. Shards other than shard 0 have no index and are
+// always walked.
 el_blockhead_t *el_find_first_avail(size_t size){
+  el_sizeindex_t *index = &el_ctl.avail_index;
+  el_blocklist_t *avail = el_avail_list();
+  if(avail == el_ctl.avail && el_ctl.rt_enabled) {
+    return el_rt_find(size + EL_BLOCK_OVERHEAD);
+  }
+  if(avail == el_ctl.avail && index->sizes != NULL) {
+    long i = el_scan_sizes(index->sizes, index->count, size + EL_BLOCK_OVERHEAD);
+    return i < 0 ? NULL : index->blocks[i];
+  }
+
   // Start iterating from the beginning of the available block list
-  el_blockhead_t *current_block = el_ctl.avail->beg->next;
+  el_blockhead_t *current_block = el_block_next(el_list_beg(avail));
 
   // Iterate until reaching the end of the available blocks
-  while(current_block != el_ctl.avail->end){
+  while(current_block != el_list_end(avail)){
     // Check if the current block can accommodate the requested size
     if(current_block->size >= size + EL_BLOCK_OVERHEAD) {
       return current_block; // Return the block if it fits the size requirements
     }
-    current_block = current_block->next; // Move to the next block
+    current_block = el_block_next(current_block); // Move to the next block
   }
   return NULL; // Return NULL if no suitable block is found
 }
@@ -313,8 +1048,8 @@ el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size){
 // for use by the user. The pointer returned is to the usable space,
 // not the block header. Makes use of find_first_avail() to find a
 // suitable block and el_split_block() to split it. Returns NULL if
-// no space is available.
-void *el_malloc(size_t nbytes){
+// no space is available. Caller must hold the heap lock.
+static void *el_list_malloc(size_t nbytes){
   // Find an available block that fits the requested size
   el_blockhead_t *user_block = el_find_first_avail(nbytes);
 
@@ -324,18 +1059,18 @@ void *el_malloc(size_t nbytes){
   }
 
   // Remove the found block from the available list
-  el_remove_block(el_ctl.avail, user_block);
+  el_remove_block(el_avail_list(), user_block);
 
   // Split the block into the requested size and get any remaining block
   el_blockhead_t *remaining_block = el_split_block(user_block, nbytes);
 
   // Add the user block to the used list
-  el_add_block_front(el_ctl.used, user_block);
+  el_add_block_front(el_used_list(), user_block);
   user_block->state = EL_USED;
 
   // If there's a remaining block after splitting, add it to the available list
   if (remaining_block) {
-    el_add_block_front(el_ctl.avail, remaining_block);
+    el_add_block_front(el_avail_list(), remaining_block);
     remaining_block->state = EL_AVAILABLE;
   }
 
@@ -344,6 +1079,80 @@ void *el_malloc(size_t nbytes){
   return user_ptr;
 }
 
+// Place an allocation of nbytes at the first multiple of align in the
+// available block, splitting off the space before and after it. Returns
+// the pointer or NULL if it does not fit in block. Caller must hold the
+// heap lock.
+static void *el_memalign_in(el_blockhead_t *block, size_t align, size_t nbytes){
+  size_t user = (size_t) PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+  size_t aligned = (user + align - 1) & ~(align - 1);
+  // a gap before the aligned pointer must hold a whole header/footer
+  while(aligned != user && aligned - user < EL_BLOCK_OVERHEAD) {
+    aligned += align;
+  }
+  size_t gap = aligned - user;
+  if(block->size < gap + nbytes) {
+    return NULL;
+  }
+
+  el_remove_block(el_ctl.avail, block);
+  el_blockhead_t *user_block = block;
+  if(gap > 0) {
+    // leave the space before the aligned block available
+    user_block = el_split_block(block, gap - EL_BLOCK_OVERHEAD);
+    el_add_block_front(el_ctl.avail, block);
+  }
+
+  el_blockhead_t *remaining_block = el_split_block(user_block, nbytes);
+  el_add_block_front(el_ctl.used, user_block);
+  user_block->state = EL_USED;
+  if(remaining_block) {
+    el_add_block_front(el_ctl.avail, remaining_block);
+    remaining_block->state = EL_AVAILABLE;
+  }
+  return PTR_PLUS_BYTES(user_block, sizeof(el_blockhead_t));
+}
+
+// Like el_list_malloc() but the returned pointer is a multiple of
+// align, which must be a power of two. Tries the available blocks in
+// list order for the first in which an aligned pointer with nbytes
+// after it can be placed. Any space before that pointer which is large
+// enough for a block of its own is split off and stays available.
+// Caller must hold the heap lock.
+static void *el_list_memalign(size_t align, size_t nbytes){
+  // in real-time mode the bins give one block certain to fit any gap so
+  // only that block is tried
+  if(el_ctl.rt_enabled) {
+    el_blockhead_t *block = el_rt_find(nbytes + align + EL_BLOCK_OVERHEAD);
+    return block == NULL ? NULL : el_memalign_in(block, align, nbytes);
+  }
+
+  // the size index yields the blocks in list order, skipping those too
+  // small for nbytes even with no gap; removed entries hold 0 so at
+  // least 1 byte is asked for
+  el_sizeindex_t *index = &el_ctl.avail_index;
+  if(index->sizes != NULL) {
+    size_t need = nbytes > 0 ? nbytes : 1;
+    for(long i = el_scan_sizes(index->sizes, index->count, need); i >= 0;
+        i = el_scan_sizes(index->sizes, i, need)) {
+      void *ptr = el_memalign_in(index->blocks[i], align, nbytes);
+      if(ptr != NULL) {
+        return ptr;
+      }
+    }
+    return NULL;
+  }
+
+  for(el_blockhead_t *block = el_block_next(el_list_beg(el_ctl.avail)); block != el_list_end(el_ctl.avail);
+      block = el_block_next(block)) {
+    void *ptr = el_memalign_in(block, align, nbytes);
+    if(ptr != NULL) {
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
 
 
 
@@ -361,7 +1170,7 @@ void *el_malloc(size_t nbytes){
 // available list and re-adds lower to the front of the available list.
 void el_merge_block_with_above(el_blockhead_t *lower){
   // Check if the lower block or its upper block are not available for merging
-  if(!lower || lower->state == EL_USED) {
+  if(!lower || lower->state != EL_AVAILABLE) {
     return;
   }
 
@@ -369,7 +1178,7 @@ void el_merge_block_with_above(el_blockhead_t *lower){
   el_blockhead_t *higher = el_block_above(lower);
 
   // Check if the higher block exists and is available for merging
-  if(!higher || higher->state == EL_USED) {
+  if(!higher || higher->state != EL_AVAILABLE) {
     return;
   }
 
@@ -377,8 +1186,9 @@ void el_merge_block_with_above(el_blockhead_t *lower){
   size_t new_size = lower->size + higher->size + EL_BLOCK_OVERHEAD;
 
   // Remove both blocks from the available list
-  el_remove_block(el_ctl.avail, lower);
-  el_remove_block(el_ctl.avail, higher);
+  el_blocklist_t *avail = el_avail_list();
+  el_remove_block(avail, lower);
+  el_remove_block(avail, higher);
 
   // Update the size of the lower block to represent the merged size
   lower->size = new_size;
@@ -388,7 +1198,7 @@ void el_merge_block_with_above(el_blockhead_t *lower){
   foot->size = new_size;
 
   // Add the merged block back to the available list
-  el_add_block_front(el_ctl.avail, lower);
+  el_add_block_front(avail, lower);
 }
 
 
@@ -401,8 +1211,9 @@ void el_merge_block_with_above(el_blockhead_t *lower){
 // Free the block pointed to by the given ptr. The area immediately
 // preceding the pointer should contain an el_blockhead_t with information
 // on the block size. Attempts to merge the free'd block with adjacent
-// blocks using el_merge_block_with_above().
-void el_free(void *ptr){
+// blocks using el_merge_block_with_above(). Caller must hold the heap
+// lock.
+static void el_list_free(void *ptr){
   // Calculate the block header from the given pointer
   el_blockhead_t *user_block = PTR_PLUS_BYTES(ptr, -sizeof(el_blockhead_t));
 
@@ -412,14 +1223,2440 @@ void el_free(void *ptr){
   }
 
   // Remove the block from the used list and mark it as available
-  el_remove_block(el_ctl.used, user_block);
+  el_remove_block(el_used_list(), user_block);
   user_block->state = EL_AVAILABLE;
 
   // Add the block to the available list
-  el_add_block_front(el_ctl.avail, user_block);
+  el_add_block_front(el_avail_list(), user_block);
 
   // Merge the block with the one above and below if possible
   el_merge_block_with_above(user_block);
   el_merge_block_with_above(el_block_below(user_block));
 }
 
+// Span allocation in whole pages
+
+// Shorthand for the span descriptor starting at page i of the region
+#define EL_SPAN(i) (&el_ctl.spans.spans[i])
+
+// Return the bin holding free spans of npages pages
+static int el_span_bin(size_t npages){
+  return npages < EL_SPAN_BINS ? npages : EL_SPAN_BINS - 1;
+}
+
+// Add the free span starting at page i to the front of its bin
+static void el_span_bin_add(int i){
+  el_spanheap_t *sh = &el_ctl.spans;
+  int bin = el_span_bin(EL_SPAN(i)->npages);
+  EL_SPAN(i)->prev = -1;
+  EL_SPAN(i)->next = sh->bins[bin];
+  if(sh->bins[bin] >= 0) {
+    EL_SPAN(sh->bins[bin])->prev = i;
+  }
+  sh->bins[bin] = i;
+}
+
+// Remove the free span starting at page i from its bin
+static void el_span_bin_remove(int i){
+  el_spanheap_t *sh = &el_ctl.spans;
+  el_span_t *span = EL_SPAN(i);
+  if(span->prev >= 0) {
+    EL_SPAN(span->prev)->next = span->next;
+  }
+  else {
+    sh->bins[el_span_bin(span->npages)] = span->next;
+  }
+  if(span->next >= 0) {
+    EL_SPAN(span->next)->prev = span->prev;
+  }
+}
+
+// Describe pages [i, i+npages) as one span in the given state. Every
+// page of a span in use maps to its start so that any pointer into it
+// can be resolved; for a free span only the first and last pages need
+// to, which is all coalescing looks at.
+static void el_span_set(int i, int npages, char state){
+  el_spanheap_t *sh = &el_ctl.spans;
+  EL_SPAN(i)->npages = npages;
+  EL_SPAN(i)->state = state;
+  if(state == EL_SPAN_FREE) {
+    sh->pagemap[i] = i;
+    sh->pagemap[i + npages - 1] = i;
+  }
+  else {
+    for(int p = i; p < i + npages; p++) {
+      sh->pagemap[p] = i;
+    }
+  }
+}
+
+// Carve the span region of npages pages out of the list heap along with
+// its descriptor and page map arrays, leaving it as a single free span.
+// Returns 0 on success and -1 if the list heap has no room.
+static int el_span_init(size_t npages){
+  el_spanheap_t *sh = &el_ctl.spans;
+  sh->pages = el_list_memalign(EL_PAGE_SIZE, npages * EL_PAGE_SIZE);
+  sh->spans = el_list_malloc(npages * sizeof(el_span_t));
+  sh->pagemap = el_list_malloc(npages * sizeof(int));
+  if(sh->pages == NULL || sh->spans == NULL || sh->pagemap == NULL) {
+    if(sh->pages != NULL) el_list_free(sh->pages);
+    if(sh->spans != NULL) el_list_free(sh->spans);
+    if(sh->pagemap != NULL) el_list_free(sh->pagemap);
+    sh->pages = NULL;
+    return -1;
+  }
+  sh->npages = npages;
+  for(int b = 0; b < EL_SPAN_BINS; b++) {
+    sh->bins[b] = -1;
+  }
+  el_span_set(0, npages, EL_SPAN_FREE);
+  el_span_bin_add(0);
+  el_radix_set(sh->pages, npages, EL_PAGE_SPAN);
+  return 0;
+}
+
+// Return the index of the free span el_span_alloc() would use for
+// npages pages or -1 if none is large enough. Bins for exact page
+// counts are tried smallest first so the best fitting span is used;
+// the final bin is searched first-fit.
+static int el_span_find(size_t npages){
+  el_spanheap_t *sh = &el_ctl.spans;
+  int i = -1;
+  for(int bin = el_span_bin(npages); bin < EL_SPAN_BINS - 1 && i < 0; bin++) {
+    i = sh->bins[bin];
+  }
+  if(i < 0) {
+    for(i = sh->bins[EL_SPAN_BINS - 1]; i >= 0 && EL_SPAN(i)->npages < npages;
+        i = EL_SPAN(i)->next) {
+    }
+  }
+  return i;
+}
+
+// Allocate a span of npages pages for the given use (EL_SPAN_USED or
+// EL_SPAN_SLAB) and return its first page or NULL if no free span is
+// large enough; see el_span_find(). Any pages beyond npages are split
+// off into a new free span.
+static void *el_span_alloc(size_t npages, char state){
+  el_spanheap_t *sh = &el_ctl.spans;
+  int i = el_span_find(npages);
+  if(i < 0) {
+    return NULL;
+  }
+
+  el_span_bin_remove(i);
+  int left = EL_SPAN(i)->npages - npages;
+  el_span_set(i, npages, state);
+  if(left > 0) {
+    el_span_set(i + npages, left, EL_SPAN_FREE);
+    el_span_bin_add(i + npages);
+  }
+  return PTR_PLUS_BYTES(sh->pages, i * EL_PAGE_SIZE);
+}
+
+// Return the index of the span holding ptr or -1 if ptr is not in the
+// span region.
+static int el_span_of(void *ptr){
+  el_spanheap_t *sh = &el_ctl.spans;
+  if(sh->pages == NULL || ptr < sh->pages ||
+     ptr >= PTR_PLUS_BYTES(sh->pages, sh->npages * EL_PAGE_SIZE)) {
+    return -1;
+  }
+  return sh->pagemap[PTR_MINUS_PTR(ptr, sh->pages) / EL_PAGE_SIZE];
+}
+
+// Free the span starting at page i, coalescing it with free neighbouring
+// spans on either side.
+static void el_span_free(int i){
+  el_spanheap_t *sh = &el_ctl.spans;
+  int npages = EL_SPAN(i)->npages;
+  if(i > 0) {
+    int below = sh->pagemap[i - 1];
+    if(EL_SPAN(below)->state == EL_SPAN_FREE) {
+      el_span_bin_remove(below);
+      npages += EL_SPAN(below)->npages;
+      i = below;
+    }
+  }
+  if(i + npages < sh->npages) {
+    int above = i + npages;
+    if(EL_SPAN(above)->state == EL_SPAN_FREE) {
+      el_span_bin_remove(above);
+      npages += EL_SPAN(above)->npages;
+    }
+  }
+  el_span_set(i, npages, EL_SPAN_FREE);
+  el_span_bin_add(i);
+}
+
+// Print the spans of the span region in address order. The format
+// appears as follows.
+//
+// SPANS: {pages:   8}
+//   [  0] @ 0x600000001000 {state: u  pages:   1}
+//   [  1] @ 0x600000002000 {state: f  pages:   7}
+void el_print_spans(){
+  el_spanheap_t *sh = &el_ctl.spans;
+  printf("SPANS: {pages: %3lu}\n", sh->pages == NULL ? 0 : sh->npages);
+  for(int i = 0; sh->pages != NULL && i < sh->npages; i += EL_SPAN(i)->npages) {
+    printf("  [%3d] @ %p {state: %c  pages: %3d}\n", i,
+           PTR_PLUS_BYTES(sh->pages, i * EL_PAGE_SIZE), EL_SPAN(i)->state, EL_SPAN(i)->npages);
+  }
+}
+
+
+// Print the slab classes and, for each, its runs with free slots. The
+// format appears as follows.
+//
+// SLAB CLASSES: {retunes: 1}
+//   [ 0] {size:  16  partial runs: 1}
+//   [ 1] {size:  48  partial runs: 0}
+//   ...
+//   retired runs: 2
+void el_print_slab_classes(){
+  printf("SLAB CLASSES: {retunes: %lu}\n", el_ctl.slab_retunes);
+  for(int cls = 0; cls < EL_SLAB_CLASSES; cls++) {
+    int partial = 0;
+    for(el_slabrun_t *run = el_ctl.slab_partial[cls]; run != NULL; run = run->next) {
+      partial++;
+    }
+    printf("  [%2d] {size: %3lu  partial runs: %d}\n", cls, el_ctl.slab_sizes[cls], partial);
+  }
+  int retired = 0;
+  for(el_slabrun_t *run = el_ctl.slab_all; run != NULL; run = run->all_next) {
+    retired += run->cls == EL_SLAB_RETIRED;
+  }
+  printf("  retired runs: %d\n", retired);
+}
+
+// Slab allocation for small sizes
+
+// Default size of each slab class, smallest first
+static const size_t el_slab_default_sizes[EL_SLAB_CLASSES] = EL_SLAB_SIZES;
+
+// Address of the first slot of a run; slots follow the header
+static void *el_slab_slots(el_slabrun_t *run){
+  return PTR_PLUS_BYTES(run, (sizeof(el_slabrun_t) + 15) & ~15UL);
+}
+
+// Unlink run from the list of runs with free slots for its class
+static void el_slab_unlink(el_slabrun_t *run){
+  if(run->prev != NULL) {
+    run->prev->next = run->next;
+  }
+  else {
+    el_ctl.slab_partial[run->cls] = run->next;
+  }
+  if(run->next != NULL) {
+    run->next->prev = run->prev;
+  }
+}
+
+// Give the entirely free run back to the span region or list heap it
+// came from. Caller must hold the heap lock.
+static void el_slab_release(el_slabrun_t *run){
+  if(run->cls != EL_SLAB_RETIRED) {
+    el_slab_unlink(run);
+  }
+  if(run->all_prev != NULL) {
+    run->all_prev->all_next = run->all_next;
+  }
+  else {
+    el_ctl.slab_all = run->all_next;
+  }
+  if(run->all_next != NULL) {
+    run->all_next->all_prev = run->all_prev;
+  }
+  run->magic = 0;
+  el_ctl.slab_runs--;
+  int span = el_span_of(run);
+  if(span >= 0) {
+    el_radix_set(run, 1, EL_PAGE_SPAN);
+    el_span_free(span);
+  }
+  else {
+    el_radix_set(run, 1, EL_PAGE_LIST);
+    el_list_free(run);
+  }
+}
+
+// Give back the empty run kept for each class, see el_slab_free().
+// Returns the number of runs given back. Caller must hold the heap
+// lock.
+static int el_slab_release_empty(){
+  int released = 0;
+  for(int cls = 0; cls < EL_SLAB_CLASSES; cls++) {
+    if(el_ctl.slab_empty[cls] != NULL) {
+      el_slab_release(el_ctl.slab_empty[cls]);
+      el_ctl.slab_empty[cls] = NULL;
+      released++;
+    }
+  }
+  return released;
+}
+
+// Fill el_ctl.slab_class_of from el_ctl.slab_sizes.
+static void el_slab_index_classes(){
+  int cls = 0;
+  for(size_t n = 0; n <= EL_SLAB_MAX_SIZE; n++) {
+    while(el_ctl.slab_sizes[cls] < n) {
+      cls++;
+    }
+    el_ctl.slab_class_of[n] = cls;
+  }
+}
+
+// Make sizes, which must be increasing and end with EL_SLAB_MAX_SIZE,
+// the slab classes. Live runs keep their slot size so they stay valid
+// whatever the classes are: each run is moved to the class of its slot
+// size if there still is one, and otherwise retired, which leaves it
+// off the lists of runs with free slots to drain as its slots are
+// freed. The empty runs kept for the old classes are given back first.
+// Caller must hold the heap lock.
+static void el_slab_set_classes(const size_t sizes[EL_SLAB_CLASSES]){
+  el_slab_release_empty();
+  memcpy(el_ctl.slab_sizes, sizes, sizeof(el_ctl.slab_sizes));
+  el_slab_index_classes();
+
+  memset(el_ctl.slab_partial, 0, sizeof(el_ctl.slab_partial));
+  for(el_slabrun_t *run = el_ctl.slab_all; run != NULL; run = run->all_next) {
+    if(run->cls == EL_SLAB_RETIRED) {
+      continue;
+    }
+    run->cls = EL_SLAB_RETIRED;
+    for(int k = 0; k < EL_SLAB_CLASSES; k++) {
+      if(sizes[k] == run->slot_size) {
+        run->cls = k;
+      }
+    }
+    if(run->cls != EL_SLAB_RETIRED && run->nfree > 0) {
+      run->prev = NULL;
+      run->next = el_ctl.slab_partial[run->cls];
+      if(run->next != NULL) {
+        run->next->prev = run;
+      }
+      el_ctl.slab_partial[run->cls] = run;
+    }
+  }
+}
+
+// Bytes of slot left unused when the requests in the histogram of
+// sizes in (lo, hi] are all served from slots of hi bytes, using
+// prefix sums of request counts (count) and bytes (bytes).
+static double el_slab_waste(const double *count, const double *bytes, size_t lo, size_t hi){
+  return hi * (count[hi] - count[lo]) - (bytes[hi] - bytes[lo]);
+}
+
+// Re-derive the slab classes from the sampled request sizes. Slot
+// sizes are chosen among multiples of EL_SLAB_TUNE_ALIGN, so slots stay
+// aligned as with the default classes, plus EL_SLAB_MAX_SIZE; dynamic
+// programming over those candidates finds the EL_SLAB_CLASSES sizes
+// leaving the fewest bytes of slot unused. Each class is a single table
+// lookup whatever its bounds, so fewer unused bytes is all there is to
+// gain. The new classes are only taken up if they cut the waste of the
+// current ones by an eighth, so that runs are not retired for marginal
+// gains. The histogram is then halved so that it follows changes in
+// demand. Caller must hold the heap lock.
+static void el_slab_retune(){
+  el_ctl.slab_tune_count = 0;
+  double count[EL_SLAB_MAX_SIZE + 1], bytes[EL_SLAB_MAX_SIZE + 1];
+  count[0] = bytes[0] = 0;
+  for(size_t n = 1; n <= EL_SLAB_MAX_SIZE; n++) {
+    count[n] = count[n - 1] + el_ctl.slab_hist[n];
+    bytes[n] = bytes[n - 1] + (double) n * el_ctl.slab_hist[n];
+  }
+
+  // candidate slot sizes, with cand[0] = 0 as the bound below the first
+  size_t cand[EL_SLAB_MAX_SIZE / EL_SLAB_TUNE_ALIGN + 2];
+  int ncand = 1;
+  cand[0] = 0;
+  for(size_t c = EL_SLAB_TUNE_ALIGN; c < EL_SLAB_MAX_SIZE; c += EL_SLAB_TUNE_ALIGN) {
+    cand[ncand++] = c;
+  }
+  cand[ncand++] = EL_SLAB_MAX_SIZE;
+  int k_max = EL_SLAB_CLASSES < ncand - 1 ? EL_SLAB_CLASSES : ncand - 1;
+
+  // best[k][j]: least waste serving sizes up to cand[j] with k classes
+  // the largest of which is cand[j]; from[k][j] is the class below it
+  double best[EL_SLAB_CLASSES + 1][EL_SLAB_MAX_SIZE / EL_SLAB_TUNE_ALIGN + 2];
+  int from[EL_SLAB_CLASSES + 1][EL_SLAB_MAX_SIZE / EL_SLAB_TUNE_ALIGN + 2];
+  for(int j = 1; j < ncand; j++) {
+    best[1][j] = el_slab_waste(count, bytes, 0, cand[j]);
+    from[1][j] = 0;
+  }
+  for(int k = 2; k <= k_max; k++) {
+    for(int j = k; j < ncand; j++) {
+      best[k][j] = -1;
+      for(int i = k - 1; i < j; i++) {
+        double w = best[k - 1][i] + el_slab_waste(count, bytes, cand[i], cand[j]);
+        if(best[k][j] < 0 || w < best[k][j]) {
+          best[k][j] = w;
+          from[k][j] = i;
+        }
+      }
+    }
+  }
+
+  // fewer candidates than classes leaves the smallest classes repeated
+  size_t sizes[EL_SLAB_CLASSES];
+  int j = ncand - 1;
+  for(int k = k_max; k >= 1; k--) {
+    sizes[EL_SLAB_CLASSES - 1 - (k_max - k)] = cand[j];
+    j = from[k][j];
+  }
+  for(int k = 0; k < EL_SLAB_CLASSES - k_max; k++) {
+    sizes[k] = sizes[EL_SLAB_CLASSES - k_max];
+  }
+
+  double current = 0;
+  size_t lo = 0;
+  for(int k = 0; k < EL_SLAB_CLASSES; k++) {
+    current += el_slab_waste(count, bytes, lo, el_ctl.slab_sizes[k]);
+    lo = el_ctl.slab_sizes[k];
+  }
+  if(best[k_max][ncand - 1] < current * 7 / 8) {
+    el_slab_set_classes(sizes);
+    el_ctl.slab_retunes++;
+  }
+  for(size_t n = 0; n <= EL_SLAB_MAX_SIZE; n++) {
+    el_ctl.slab_hist[n] /= 2;
+  }
+}
+
+// Carve a new run for class cls out of a span if there is a span region
+// or else a page-aligned page from the list heap and put it on the
+// class's list of runs with free slots.
+// Returns NULL if the list heap has no room.
+static el_slabrun_t *el_slab_new_run(int cls){
+  el_slabrun_t *run = NULL;
+  if(el_ctl.spans.pages != NULL) {
+    run = el_span_alloc(EL_SLAB_RUN_BYTES / EL_PAGE_SIZE, EL_SPAN_SLAB);
+  }
+  if(run == NULL) {
+    run = el_list_memalign(EL_SLAB_RUN_BYTES, EL_SLAB_RUN_BYTES);
+  }
+  if(run == NULL) {
+    return NULL;
+  }
+  run->magic = EL_SLAB_MAGIC;
+  run->self = run;
+  run->cls = cls;
+  run->slot_size = el_ctl.slab_sizes[cls];
+  run->nslots = (EL_SLAB_RUN_BYTES - PTR_MINUS_PTR(el_slab_slots(run), run)) / run->slot_size;
+  run->nfree = run->nslots;
+  memset(run->bitmap, 0, sizeof(run->bitmap));
+  for(int i = 0; i < run->nslots; i++) {
+    run->bitmap[i / 64] |= 1UL << (i % 64);
+  }
+  run->prev = NULL;
+  run->next = el_ctl.slab_partial[cls];
+  if(run->next != NULL) {
+    run->next->prev = run;
+  }
+  el_ctl.slab_partial[cls] = run;
+  run->all_prev = NULL;
+  run->all_next = el_ctl.slab_all;
+  if(run->all_next != NULL) {
+    run->all_next->all_prev = run;
+  }
+  el_ctl.slab_all = run;
+  el_ctl.slab_runs++;
+  el_radix_set(run, 1, EL_PAGE_SLAB | (el_pageent_t) run);
+  return run;
+}
+
+// Allocate a slot of the smallest slab class holding nbytes, which is
+// looked up in el_ctl.slab_class_of. The request is counted for tuning.
+// The slot is the first free one in the first run of the class with any
+// free, found with a find-first-set on the run's bitmap. Caller must
+// hold the heap lock and ensure 0 < nbytes <= EL_SLAB_MAX_SIZE.
+static void *el_slab_malloc(size_t nbytes){
+  el_ctl.slab_hist[nbytes]++;
+  if(el_ctl.slab_tune_period != 0 && ++el_ctl.slab_tune_count >= el_ctl.slab_tune_period) {
+    el_slab_retune();
+  }
+  int cls = el_ctl.slab_class_of[nbytes];
+  el_slabrun_t *run = el_ctl.slab_partial[cls];
+  if(run == NULL) {
+    run = el_slab_new_run(cls);
+    if(run == NULL) {
+      return NULL;
+    }
+  }
+  int w = 0;
+  while(run->bitmap[w] == 0) {
+    w++;
+  }
+  int bit = __builtin_ctzl(run->bitmap[w]);
+  run->bitmap[w] &= ~(1UL << bit);
+  run->nfree--;
+  if(run == el_ctl.slab_empty[cls]) {
+    el_ctl.slab_empty[cls] = NULL;
+  }
+  if(run->nfree == 0) {
+    el_slab_unlink(run);
+  }
+  return PTR_PLUS_BYTES(el_slab_slots(run), (size_t) (w * 64 + bit) * run->slot_size);
+}
+
+// Return the slot ptr to its run. A run which was full goes back on its
+// class's list unless it has been retired. A run which becomes entirely
+// free is kept, still on its class's list, if its class has no empty
+// run yet, so that a loop allocating and freeing one object does not
+// carve and give back a run each time; otherwise it is given back to
+// the span region or list heap it came from. Caller must hold the heap
+// lock.
+static void el_slab_free(el_slabrun_t *run, void *ptr){
+  int i = PTR_MINUS_PTR(ptr, el_slab_slots(run)) / run->slot_size;
+  run->bitmap[i / 64] |= 1UL << (i % 64);
+  run->nfree++;
+  if(run->nfree == 1 && run->cls != EL_SLAB_RETIRED) {
+    run->prev = NULL;
+    run->next = el_ctl.slab_partial[run->cls];
+    if(run->next != NULL) {
+      run->next->prev = run;
+    }
+    el_ctl.slab_partial[run->cls] = run;
+  }
+  if(run->nfree == run->nslots) {
+    if(run->cls != EL_SLAB_RETIRED && el_ctl.slab_empty[run->cls] == NULL) {
+      el_ctl.slab_empty[run->cls] = run;
+    }
+    else {
+      el_slab_release(run);
+    }
+  }
+}
+
+
+// Tiny object allocation
+
+// Size of each tiny class, smallest first
+static const int el_tiny_sizes[EL_TINY_CLASSES] = EL_TINY_SIZES;
+
+// Put tp at the front of the list of tiny pages with free slots for its
+// class
+static void el_tiny_link(el_tinypage_t *tp){
+  tp->prev = NULL;
+  tp->next = el_ctl.tiny_partial[tp->cls];
+  if(tp->next != NULL) {
+    tp->next->prev = tp;
+  }
+  el_ctl.tiny_partial[tp->cls] = tp;
+}
+
+// Unlink tp from the list of tiny pages with free slots for its class
+static void el_tiny_unlink(el_tinypage_t *tp){
+  if(tp->prev != NULL) {
+    tp->prev->next = tp->next;
+  }
+  else {
+    el_ctl.tiny_partial[tp->cls] = tp->next;
+  }
+  if(tp->next != NULL) {
+    tp->next->prev = tp->prev;
+  }
+}
+
+// Set up a new tiny page for class cls taken from the span region if
+// there is one or else the list heap, with its metadata in the list
+// heap. Returns NULL if there is no room.
+static el_tinypage_t *el_tiny_new_page(int cls){
+  // the radix map entry keeps its kind in the low bits of tp
+  el_tinypage_t *tp = el_list_memalign(sizeof(void *), sizeof(el_tinypage_t));
+  if(tp == NULL) {
+    return NULL;
+  }
+  tp->page = NULL;
+  if(el_ctl.spans.pages != NULL) {
+    tp->page = el_span_alloc(1, EL_SPAN_SLAB);
+  }
+  if(tp->page == NULL) {
+    tp->page = el_list_memalign(EL_PAGE_SIZE, EL_PAGE_SIZE);
+  }
+  if(tp->page == NULL) {
+    el_list_free(tp);
+    return NULL;
+  }
+  tp->cls = cls;
+  tp->slot_size = el_tiny_sizes[cls];
+  tp->nslots = EL_PAGE_SIZE / tp->slot_size;
+  tp->nfree = tp->nslots;
+  memset(tp->bitmap, 0, sizeof(tp->bitmap));
+  for(int i = 0; i < tp->nslots; i++) {
+    tp->bitmap[i / 64] |= 1UL << (i % 64);
+  }
+  el_tiny_link(tp);
+  tp->all_prev = NULL;
+  tp->all_next = el_ctl.tiny_all;
+  if(tp->all_next != NULL) {
+    tp->all_next->all_prev = tp;
+  }
+  el_ctl.tiny_all = tp;
+  el_radix_set(tp->page, 1, EL_PAGE_TINY | (el_pageent_t) tp);
+  return tp;
+}
+
+// Allocate a slot of the smallest tiny class holding nbytes from the
+// first page of that class with a free slot. Caller must hold the heap
+// lock and ensure nbytes <= EL_TINY_MAX_SIZE.
+static void *el_tiny_malloc(size_t nbytes){
+  int cls = 0;
+  while(el_tiny_sizes[cls] < nbytes) {
+    cls++;
+  }
+  el_tinypage_t *tp = el_ctl.tiny_partial[cls];
+  if(tp == NULL) {
+    tp = el_tiny_new_page(cls);
+    if(tp == NULL) {
+      return NULL;
+    }
+  }
+  int w = 0;
+  while(tp->bitmap[w] == 0) {
+    w++;
+  }
+  int bit = __builtin_ctzl(tp->bitmap[w]);
+  tp->bitmap[w] &= ~(1UL << bit);
+  tp->nfree--;
+  if(tp == el_ctl.tiny_empty[cls]) {
+    el_ctl.tiny_empty[cls] = NULL;
+  }
+  if(tp->nfree == 0) {
+    el_tiny_unlink(tp);
+  }
+  return PTR_PLUS_BYTES(tp->page, (size_t) (w * 64 + bit) * tp->slot_size);
+}
+
+// Give the entirely free tiny page tp back to the span region or list
+// heap it came from along with its metadata. Caller must hold the heap
+// lock.
+static void el_tiny_release(el_tinypage_t *tp){
+  el_tiny_unlink(tp);
+  if(tp->all_prev != NULL) {
+    tp->all_prev->all_next = tp->all_next;
+  }
+  else {
+    el_ctl.tiny_all = tp->all_next;
+  }
+  if(tp->all_next != NULL) {
+    tp->all_next->all_prev = tp->all_prev;
+  }
+  int span = el_span_of(tp->page);
+  if(span >= 0) {
+    el_radix_set(tp->page, 1, EL_PAGE_SPAN);
+    el_span_free(span);
+  }
+  else {
+    el_radix_set(tp->page, 1, EL_PAGE_LIST);
+    el_list_free(tp->page);
+  }
+  el_list_free(tp);
+}
+
+// Give back the empty page kept for each tiny class, see
+// el_tiny_free(). Returns the number of pages given back. Caller must
+// hold the heap lock.
+static int el_tiny_release_empty(){
+  int released = 0;
+  for(int cls = 0; cls < EL_TINY_CLASSES; cls++) {
+    if(el_ctl.tiny_empty[cls] != NULL) {
+      el_tiny_release(el_ctl.tiny_empty[cls]);
+      el_ctl.tiny_empty[cls] = NULL;
+      released++;
+    }
+  }
+  return released;
+}
+
+// Return the slot ptr to the tiny page described by tp. A page which
+// becomes entirely free is kept, still on its class's list, if its
+// class has no empty page yet; otherwise it is given back along with
+// its metadata. Caller must hold the heap lock.
+static void el_tiny_free(el_tinypage_t *tp, void *ptr){
+  int i = PTR_MINUS_PTR(ptr, tp->page) / tp->slot_size;
+  tp->bitmap[i / 64] |= 1UL << (i % 64);
+  tp->nfree++;
+  if(tp->nfree == 1) {
+    el_tiny_link(tp);
+  }
+  if(tp->nfree == tp->nslots) {
+    if(el_ctl.tiny_empty[tp->cls] == NULL) {
+      el_ctl.tiny_empty[tp->cls] = tp;
+    }
+    else {
+      el_tiny_release(tp);
+    }
+  }
+}
+
+// Public allocation/free functions; these take the heap lock so that
+// they may be called from several threads, or in a shared heap from
+// several processes, at once.
+
+// Route a request to the tier that serves its size; the heap lock must
+// be held. With the tiny tier enabled the smallest requests are served
+// from tiny pages and with the slab tier enabled other small requests
+// are served from slab runs, when a page or run has room or can be
+// carved; with a span region medium requests of at least
+// EL_SPAN_MIN_SIZE bytes are given whole pages from it when possible.
+// Everything else, including a small request no page or run can take,
+// comes from the block lists.
+static void *el_tier_malloc(size_t nbytes){
+  void *ptr = NULL;
+  if(el_ctl.tiny_enabled && nbytes > 0 && nbytes <= EL_TINY_MAX_SIZE) {
+    ptr = el_tiny_malloc(nbytes);
+  }
+  else if(el_ctl.slab_enabled && nbytes > 0 && nbytes <= EL_SLAB_MAX_SIZE) {
+    ptr = el_slab_malloc(nbytes);
+  }
+  else if(el_ctl.spans.pages != NULL && nbytes >= EL_SPAN_MIN_SIZE) {
+    ptr = el_span_alloc((nbytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE, EL_SPAN_USED);
+  }
+  if(ptr == NULL) {
+    ptr = el_list_malloc(nbytes);
+  }
+  return ptr;
+}
+
+// Return ptr to the tier it came from; the heap lock must be held. The
+// radix map entry for ptr's page says which tier that is.
+static void el_tier_free(void *ptr){
+  el_pageent_t ent = el_radix_get(ptr);
+  switch(EL_PAGE_KIND(ent)) {
+  case EL_PAGE_TINY:
+    el_tiny_free(EL_PAGE_PTR(ent), ptr);
+    break;
+  case EL_PAGE_SLAB:
+    el_slab_free(EL_PAGE_PTR(ent), ptr);
+    break;
+  case EL_PAGE_SPAN:
+    el_span_free(el_span_of(ptr));
+    break;
+  case EL_PAGE_NONE:
+    break;                              // NULL or not from this heap
+  default:
+    el_list_free(ptr);
+  }
+}
+
+// Aligned counterpart of el_tier_malloc(); the heap lock must be held.
+// Tiny and slab slots sit at multiples of their slot size within
+// aligned pages and spans start on page boundaries, so a request
+// rounded up to a multiple of align that lands in one of those tiers is
+// usually aligned already; otherwise the block lists carve out an
+// aligned block.
+static void *el_tier_memalign(size_t align, size_t nbytes){
+  size_t rounded = (nbytes + align - 1) & ~(align - 1);
+  void *ptr = NULL;
+  int tiered =
+    (el_ctl.tiny_enabled && rounded > 0 && rounded <= EL_TINY_MAX_SIZE) ||
+    (el_ctl.slab_enabled && rounded > 0 && rounded <= EL_SLAB_MAX_SIZE) ||
+    (el_ctl.spans.pages != NULL && rounded >= EL_SPAN_MIN_SIZE &&
+     align <= EL_PAGE_SIZE);
+  if(tiered) {
+    ptr = el_tier_malloc(rounded);
+    if(ptr != NULL && (uintptr_t) ptr % align != 0) {
+      el_tier_free(ptr);                  // slot size not a multiple of align
+      ptr = NULL;
+    }
+  }
+  if(ptr == NULL) {
+    ptr = el_list_memalign(align, nbytes);
+  }
+  return ptr;
+}
+
+// Return the usable bytes of the block at ptr; ent is the radix map
+// entry of its page, which says which tier the block came from. A
+// pointer outside the heap has none.
+static size_t el_block_bytes(void *ptr, el_pageent_t ent){
+  switch(EL_PAGE_KIND(ent)) {
+  case EL_PAGE_NONE:
+    return 0;
+  case EL_PAGE_TINY:
+    return ((el_tinypage_t *) EL_PAGE_PTR(ent))->slot_size;
+  case EL_PAGE_SLAB:
+    return ((el_slabrun_t *) EL_PAGE_PTR(ent))->slot_size;
+  case EL_PAGE_SPAN:
+    return (size_t) EL_SPAN(el_span_of(ptr))->npages * EL_PAGE_SIZE;
+  default:
+    return ((el_blockhead_t *) PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)))->size;
+  }
+}
+
+// Return 1 and count a failure if nbytes more in use would cross the
+// hard limit; the heap lock or a shard's must be held. The counters are
+// updated atomically as threads holding different shards' locks share
+// them; requests racing in different shards may overshoot the limit by
+// a block each.
+static int el_budget_refuse(size_t nbytes){
+  el_budget_t *b = &el_ctl.budget;
+  if(b->hard_limit != 0 && __atomic_load_n(&b->in_use, __ATOMIC_RELAXED) + nbytes > b->hard_limit) {
+    __atomic_add_fetch(&b->hard_failures, 1, __ATOMIC_RELAXED);
+    return 1;
+  }
+  return 0;
+}
+
+// Add bytes to those in use, leaving the pressure callbacks due for
+// el_unlock_pressure() if that crosses the soft limit; the heap lock or
+// a shard's must be held.
+static void el_budget_add(size_t bytes){
+  el_budget_t *b = &el_ctl.budget;
+  size_t before = __atomic_fetch_add(&b->in_use, bytes, __ATOMIC_RELAXED);
+  size_t after = before + bytes;
+  size_t peak = __atomic_load_n(&b->peak, __ATOMIC_RELAXED);
+  while(after > peak &&
+        !__atomic_compare_exchange_n(&b->peak, &peak, after, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  if(b->soft_limit != 0 && before <= b->soft_limit && after > b->soft_limit) {
+    __atomic_add_fetch(&b->soft_crossings, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->pressure_pending, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Take bytes off those in use, stopping at zero; the heap lock or a
+// shard's must be held.
+static void el_budget_sub(size_t bytes){
+  el_budget_t *b = &el_ctl.budget;
+  size_t in_use = __atomic_load_n(&b->in_use, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&b->in_use, &in_use, bytes < in_use ? in_use - bytes : 0,
+                                     1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// Charge the block at ptr, if any, to the budget and return it. The
+// block may be larger than was asked for; if that crosses the hard
+// limit it is given back and NULL returned. Crossing the soft limit
+// leaves the pressure callbacks due for el_unlock_pressure().
+static void *el_budget_charge(void *ptr){
+  if(ptr == NULL) {
+    return NULL;
+  }
+  size_t bytes = el_block_bytes(ptr, el_radix_get(ptr));
+  if(el_budget_refuse(bytes)) {
+    el_tier_free(ptr);
+    return NULL;
+  }
+  el_budget_add(bytes);
+  return ptr;
+}
+
+// Take the block at ptr off the budget before it is freed. Blocks which
+// predate the accounting, such as those in a restored snapshot, may
+// take in_use below their size so it stops at zero.
+static void el_budget_discharge(void *ptr){
+  el_pageent_t ent = el_radix_get(ptr);
+  if(EL_PAGE_KIND(ent) == EL_PAGE_NONE) {
+    return;                             // NULL or not from this heap
+  }
+  if(EL_PAGE_KIND(ent) == EL_PAGE_LIST &&
+     ((el_blockhead_t *) PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)))->state != EL_USED) {
+    return;                             // el_list_free() ignores double frees
+  }
+  el_budget_sub(el_block_bytes(ptr, ent));
+}
+
+// Release the heap lock, then run the pressure callbacks if an
+// allocation crossed the soft limit. The callbacks run unlocked so that
+// they may free memory; each is passed the bytes in use when they were
+// collected.
+static void el_unlock_pressure(){
+  el_budget_t *b = &el_ctl.budget;
+  if(!__atomic_exchange_n(&b->pressure_pending, 0, __ATOMIC_RELAXED)) {
+    el_unlock();
+    return;
+  }
+  size_t in_use = b->in_use;
+  int n = b->ncallbacks;
+  el_pressure_fn fns[EL_MAX_PRESSURE_CALLBACKS];
+  void *args[EL_MAX_PRESSURE_CALLBACKS];
+  memcpy(fns, b->callbacks, n * sizeof(fns[0]));
+  memcpy(args, b->callback_args, n * sizeof(args[0]));
+  el_unlock();
+  for(int i = 0; i < n; i++) {
+    fns[i](in_use, args[i]);
+  }
+}
+
+// Allocate nbytes from the tiers within the budget, aligned to align
+// unless it is 0; the heap lock must be held.
+static void *el_try_alloc(size_t align, size_t nbytes){
+  if(el_budget_refuse(nbytes)) {
+    return NULL;
+  }
+  return el_budget_charge(align == 0 ? el_tier_malloc(nbytes) : el_tier_memalign(align, nbytes));
+}
+
+// set while this thread runs the out-of-memory handlers so that an
+// allocation failing inside one does not start the chain again
+static __thread int el_in_oom;
+
+// Run the out-of-memory handlers in the order they were added, retrying
+// the allocation of nbytes aligned to align (0 for none) after each one
+// that reports it may have freed memory. The handlers run without the
+// heap lock. Returns the block or NULL if every handler has been tried.
+static void *el_oom_retry(size_t align, size_t nbytes){
+  el_oomchain_t *oc = &el_ctl.oom;
+  if(el_in_oom || oc->nhandlers == 0) {
+    return NULL;
+  }
+  el_in_oom = 1;
+  el_lock();
+  oc->runs++;
+  int n = oc->nhandlers;
+  el_oom_fn fns[EL_MAX_OOM_HANDLERS];
+  void *args[EL_MAX_OOM_HANDLERS];
+  memcpy(fns, oc->handlers, n * sizeof(fns[0]));
+  memcpy(args, oc->handler_args, n * sizeof(args[0]));
+  el_unlock();
+
+  void *ptr = NULL;
+  for(int i = 0; i < n && ptr == NULL; i++) {
+    if(!fns[i](nbytes, args[i])) {
+      continue;                         // nothing freed, nothing to retry
+    }
+    el_lock();
+    ptr = el_try_alloc(align, nbytes);
+    if(ptr != NULL) {
+      oc->rescues++;
+    }
+    el_unlock_pressure();
+  }
+  el_in_oom = 0;
+  return ptr;
+}
+
+// Shards
+
+// Return the shard whose range holds ptr, found from its address
+// alone. Pointers outside the heap, and every pointer if the heap is
+// not split, are given shard 0.
+static int el_shard_of(void *ptr){
+  if(el_ctl.nshards == 0 || ptr < el_ctl.heap_start || ptr >= el_ctl.heap_end) {
+    return 0;
+  }
+  size_t k = PTR_MINUS_PTR(ptr, el_ctl.heap_start) / el_ctl.shard_bytes;
+  return k < el_ctl.nshards ? k : el_ctl.nshards - 1; // the last takes the remainder
+}
+
+// Return the end of shard k's range: the next shard's fence or heap_end.
+static void *el_shard_end(int k){
+  return k + 1 < el_ctl.nshards ? (void *) el_ctl.shards[k + 1].fence : el_ctl.heap_end;
+}
+
+// Take the lock of shard k, k > 0, and make its lists those the list
+// routines work on.
+static void el_shard_lock(int k){
+  pthread_mutex_lock(&el_ctl.shards[k].lock);
+  el_cur_shard = &el_ctl.shards[k];
+}
+
+// Release the lock of shard k, k > 0.
+static void el_shard_unlock(int k){
+  el_cur_shard = NULL;
+  pthread_mutex_unlock(&el_ctl.shards[k].lock);
+}
+
+// Release the lock of shard k, k > 0, then run the pressure callbacks
+// if an allocation crossed the soft limit, as el_unlock_pressure()
+// does for shard 0.
+static void el_shard_unlock_pressure(int k){
+  el_shard_unlock(k);
+  if(__atomic_load_n(&el_ctl.budget.pressure_pending, __ATOMIC_RELAXED)) {
+    el_lock();
+    el_unlock_pressure();
+  }
+}
+
+static unsigned el_shard_tickets;       // handed to threads in turn
+static __thread unsigned el_shard_ticket; // this thread's, 0 until it first allocates
+
+// Return the calling thread's preferred shard. Threads are spread over
+// the shards in the order they first allocate, the first getting
+// shard 0.
+static int el_home_shard(){
+  if(el_shard_ticket == 0) {
+    el_shard_ticket = __atomic_add_fetch(&el_shard_tickets, 1, __ATOMIC_RELAXED);
+  }
+  return (el_shard_ticket - 1) % el_ctl.nshards;
+}
+
+// Return 1 if a request of nbytes would be served from the block lists
+// rather than a tier and so may come from any shard; the tiers live in
+// shard 0.
+static int el_shard_serves(size_t nbytes){
+  return nbytes > 0 &&
+    !(el_ctl.tiny_enabled && nbytes <= EL_TINY_MAX_SIZE) &&
+    !(el_ctl.slab_enabled && nbytes <= EL_SLAB_MAX_SIZE) &&
+    !(el_ctl.spans.pages != NULL && nbytes >= EL_SPAN_MIN_SIZE);
+}
+
+// Allocate nbytes from the lists of the calling thread's preferred
+// shard, falling back to the others in turn, shard 0 included, each
+// under its own lock. Returns NULL if the hard limit refuses the
+// request or no shard has the space.
+static void *el_shard_malloc(size_t nbytes){
+  if(el_budget_refuse(nbytes)) {
+    return NULL;
+  }
+  int home = el_home_shard();
+  for(int i = 0; i < el_ctl.nshards; i++) {
+    int k = (home + i) % el_ctl.nshards;
+    if(k == 0) {
+      el_lock();
+    }
+    else {
+      el_shard_lock(k);
+    }
+    void *ptr = el_budget_charge(el_list_malloc(nbytes));
+    if(ptr != NULL) {
+      el_ctl.shards[k].mallocs++;
+      el_ctl.shards[k].fallbacks += (i > 0);
+    }
+    if(k == 0) {
+      el_unlock_pressure();
+    }
+    else {
+      el_shard_unlock_pressure(k);
+    }
+    if(ptr != NULL) {
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
+// Free the list block at ptr in shard k, k > 0; the shard's lock must
+// be held. Shards other than 0 hold only list blocks so the radix map
+// is not needed.
+static void el_shard_free(void *ptr){
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  if(block->state == EL_USED) {
+    el_budget_sub(block->size);
+  }
+  el_list_free(ptr);
+}
+
+// Split the heap into nshards shards; see EL_OPT_SHARDS. The heap lock
+// must be held. Returns 0 on success and -1 if the heap cannot be
+// split.
+static int el_shard_split(int nshards){
+  size_t shard_bytes = (el_ctl.heap_bytes / nshards) & ~(EL_PAGE_SIZE - 1);
+  el_blockhead_t *first = el_ctl.heap_start;
+  if(nshards < 2 || nshards > EL_MAX_SHARDS || el_ctl.nshards != 0 ||
+     el_ctl.meta != NULL || el_ctl.rt_enabled || el_ctl.spans.pages != NULL ||
+     el_ctl.used->length != 0 || el_ctl.avail->length != 1 || first->state != EL_AVAILABLE ||
+     shard_bytes < EL_PAGE_SIZE + sizeof(el_fencelists_t) + 2 * EL_BLOCK_OVERHEAD) {
+    return -1;
+  }
+
+  // shard 0 keeps the bottom of the single available block
+  el_remove_block(el_ctl.avail, first);
+  first->size = shard_bytes - EL_BLOCK_OVERHEAD;
+  el_get_footer(first)->size = first->size;
+  el_add_block_front(el_ctl.avail, first);
+  el_ctl.shards[0].fence = NULL;
+  el_ctl.shards[0].avail = el_ctl.avail;
+  el_ctl.shards[0].used = el_ctl.used;
+
+  // every other shard is a fence holding its lists followed by one
+  // available block reaching the next fence
+  for(int k = 1; k < nshards; k++) {
+    el_shard_t *sh = &el_ctl.shards[k];
+    void *end = k + 1 < nshards ?
+      PTR_PLUS_BYTES(el_ctl.heap_start, (k + 1) * shard_bytes) : el_ctl.heap_end;
+    sh->fence = PTR_PLUS_BYTES(el_ctl.heap_start, k * shard_bytes);
+    sh->fence->size = sizeof(el_fencelists_t);
+    sh->fence->state = EL_FENCE;
+    el_get_footer(sh->fence)->size = sh->fence->size;
+    el_fencelists_t *lists = PTR_PLUS_BYTES(sh->fence, sizeof(el_blockhead_t));
+    el_init_blocklist(&lists->avail_actual);
+    el_init_blocklist(&lists->used_actual);
+    sh->avail = &lists->avail_actual;
+    sh->used = &lists->used_actual;
+
+    el_blockhead_t *block = el_block_above(sh->fence);
+    block->size = PTR_MINUS_PTR(end, block) - EL_BLOCK_OVERHEAD;
+    block->state = EL_AVAILABLE;
+    el_get_footer(block)->size = block->size;
+    el_add_block_front(sh->avail, block);
+    pthread_mutex_init(&sh->lock, NULL);
+    sh->mallocs = 0;
+    sh->fallbacks = 0;
+  }
+  el_ctl.shards[0].mallocs = 0;
+  el_ctl.shards[0].fallbacks = 0;
+  el_ctl.shard_bytes = shard_bytes;
+  el_ctl.nshards = nshards;
+  return 0;
+}
+
+// Print each shard's lists and counters. The format appears as
+// follows.
+//
+// SHARDS: {count: 2  bytes: 32768}
+//   [ 0] @ 0x600000000000 {avail: 1 / 32728  used: 1 / 140  mallocs: 1  fallbacks: 0}
+//   [ 1] @ 0x600000008000 {avail: 1 / 32296  used: 0 / 0  mallocs: 0  fallbacks: 0}
+void el_print_shards(){
+  printf("SHARDS: {count: %d  bytes: %lu}\n", el_ctl.nshards, el_ctl.shard_bytes);
+  for(int k = 0; k < el_ctl.nshards; k++) {
+    el_shard_t *sh = &el_ctl.shards[k];
+    printf("  [%2d] @ %p {avail: %lu / %lu  used: %lu / %lu  mallocs: %lu  fallbacks: %lu}\n", k,
+           k == 0 ? el_ctl.heap_start : (void *) sh->fence,
+           (unsigned long) sh->avail->length, (unsigned long) sh->avail->bytes,
+           (unsigned long) sh->used->length, (unsigned long) sh->used->bytes,
+           sh->mallocs, sh->fallbacks);
+  }
+}
+
+// Deferred frees
+
+// Push the block at ptr on the stack of pending frees if frees are
+// still deferred and it is an ordinary list block with room for the
+// link; a block shrunk by el_realloc() may not have it. The push is
+// counted in pushing while it is under way and interval_ms is checked
+// again after that, so el_defer_set() either sees the push or the push
+// sees deferral stopped. Returns 1 if it was pushed and 0 if it must be
+// freed at once.
+static int el_defer_push(void *ptr){
+  el_defer_t *d = &el_ctl.defer;
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  __atomic_add_fetch(&d->pushing, 1, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&d->interval_ms, __ATOMIC_SEQ_CST) == 0 ||
+     EL_PAGE_KIND(el_radix_get(ptr)) != EL_PAGE_LIST || block->state != EL_USED ||
+     block->size < sizeof(void *)) {
+    __atomic_sub_fetch(&d->pushing, 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+  block->state = EL_PENDING;            // still not to be merged with
+  void *top = __atomic_load_n(&d->pending, __ATOMIC_RELAXED);
+  do {
+    *(void **) ptr = top;
+  } while(!__atomic_compare_exchange_n(&d->pending, &top, ptr, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __atomic_add_fetch(&d->deferred, 1, __ATOMIC_RELAXED);
+  if(__atomic_add_fetch(&d->npending, 1, __ATOMIC_RELAXED) % EL_DEFER_BATCH == 0) {
+    pthread_cond_signal(&el_defer_wake);
+  }
+  __atomic_sub_fetch(&d->pushing, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+// Free every block on the stack of pending frees, sorted by shard so
+// that each shard's lock is taken once. The stack is taken whole so
+// blocks pushed meanwhile wait for the next call. Returns the number
+// of blocks freed.
+static size_t el_defer_drain(){
+  el_defer_t *d = &el_ctl.defer;
+  void *ptr = __atomic_exchange_n(&d->pending, NULL, __ATOMIC_ACQUIRE);
+  if(ptr == NULL) {
+    return 0;
+  }
+  void *heads[EL_MAX_SHARDS] = {NULL};
+  size_t n = 0;
+  while(ptr != NULL) {
+    void *next = *(void **) ptr;
+    int k = el_shard_of(ptr);
+    ((el_blockhead_t *) PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)))->state = EL_USED;
+    *(void **) ptr = heads[k];
+    heads[k] = ptr;
+    ptr = next;
+    n++;
+  }
+  __atomic_sub_fetch(&d->npending, n, __ATOMIC_RELAXED);
+
+  // freeing may reuse a block's payload so each link is read first
+  el_lock();
+  for(ptr = heads[0]; ptr != NULL; ) {
+    void *next = *(void **) ptr;
+    el_budget_discharge(ptr);
+    el_tier_free(ptr);
+    ptr = next;
+  }
+  el_unlock();
+  for(int k = 1; k < el_ctl.nshards; k++) {
+    if(heads[k] == NULL) {
+      continue;
+    }
+    el_shard_lock(k);
+    for(ptr = heads[k]; ptr != NULL; ) {
+      void *next = *(void **) ptr;
+      el_shard_free(ptr);
+      ptr = next;
+    }
+    el_shard_unlock(k);
+  }
+  __atomic_add_fetch(&d->drained, n, __ATOMIC_RELAXED);
+  return n;
+}
+
+// Body of the maintenance thread: each interval, or when signalled,
+// free the pending blocks and trim the heap if any were freed.
+static void *el_defer_main(void *arg){
+  el_defer_t *d = &el_ctl.defer;
+  pthread_mutex_lock(&el_defer_lock);
+  while(!d->stop) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += d->interval_ms / 1000;
+    until.tv_nsec += (d->interval_ms % 1000) * 1000000;
+    if(until.tv_nsec >= 1000000000) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&el_defer_wake, &el_defer_lock, &until);
+    if(d->stop) {
+      break;
+    }
+    pthread_mutex_unlock(&el_defer_lock);
+    if(el_defer_drain() > 0) {
+      el_trim();
+    }
+    __atomic_add_fetch(&d->passes, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&el_defer_lock);
+  }
+  pthread_mutex_unlock(&el_defer_lock);
+  return NULL;
+}
+
+// Start the maintenance thread with a pass every interval_ms, change
+// the interval of a running one, or with 0 stop it and free what it
+// left pending, including blocks whose push was under way as it
+// stopped; see EL_OPT_DEFER_FREE. Must not be called with the heap
+// lock held. Returns 0 on success and -1 on failure.
+static int el_defer_set(long interval_ms){
+  el_defer_t *d = &el_ctl.defer;
+  if(interval_ms < 0 || (interval_ms > 0 && (el_ctl.heap_start == NULL || el_ctl.meta != NULL))) {
+    return -1;
+  }
+  pthread_mutex_lock(&el_defer_lock);
+  if(interval_ms > 0) {
+    int ret = 0;
+    if(d->interval_ms == 0) {
+      d->stop = 0;
+      ret = pthread_create(&d->thread, NULL, el_defer_main, NULL) == 0 ? 0 : -1;
+    }
+    else {
+      pthread_cond_signal(&el_defer_wake);
+    }
+    if(ret == 0) {
+      d->interval_ms = interval_ms;
+    }
+    pthread_mutex_unlock(&el_defer_lock);
+    return ret;
+  }
+  if(d->interval_ms == 0) {
+    pthread_mutex_unlock(&el_defer_lock);
+    return 0;
+  }
+  __atomic_store_n(&d->interval_ms, 0, __ATOMIC_SEQ_CST);
+  d->stop = 1;
+  pthread_cond_signal(&el_defer_wake);
+  pthread_mutex_unlock(&el_defer_lock);
+  pthread_join(d->thread, NULL);
+  while(__atomic_load_n(&d->pushing, __ATOMIC_ACQUIRE) > 0) {
+    sched_yield();
+  }
+  el_defer_drain();
+  return 0;
+}
+
+// Print the state of deferred frees. The format appears as follows.
+//
+// DEFER: {interval: 10 ms  pending: 2  deferred: 5  drained: 3  passes: 1  forced: 0}
+void el_print_defer(){
+  el_defer_t *d = &el_ctl.defer;
+  printf("DEFER: {interval: %ld ms  pending: %lu  deferred: %lu  drained: %lu  passes: %lu  forced: %lu}\n",
+         d->interval_ms, d->npending, d->deferred, d->drained, d->passes, d->forced);
+}
+
+// Per-thread free buffers
+
+// Type for the frees gathered by one thread, see EL_OPT_FREE_BUFFER
+typedef struct {
+  void *ptrs[EL_FREE_BUFFER_MAX];
+  int count;
+  unsigned long epoch;          // el_ctl.epoch when the first was added
+  int watched;                  // 1 once the thread's exit will flush it
+} el_freebuf_t;
+
+static __thread el_freebuf_t el_free_buf;
+static pthread_key_t el_free_buf_key;
+static pthread_once_t el_free_buf_once = PTHREAD_ONCE_INIT;
+
+// Run as a thread exits so that its buffered frees are not lost.
+static void el_free_buf_exit(void *arg){
+  el_free_flush();
+}
+
+static void el_free_buf_key_init(){
+  pthread_key_create(&el_free_buf_key, el_free_buf_exit);
+}
+
+static int el_cmp_ptr(const void *a, const void *b){
+  uintptr_t x = (uintptr_t) *(void * const *) a, y = (uintptr_t) *(void * const *) b;
+  return (x > y) - (x < y);
+}
+
+// Free the blocks the calling thread has buffered with el_free(). They
+// are sorted by address first so that el_free_batch() frees each
+// shard's blocks under one acquisition of its lock, and neighbouring
+// blocks merge in one sweep from the bottom of the heap up. Blocks
+// buffered before the heap was torn down are dropped. Returns the
+// number of blocks freed.
+int el_free_flush(){
+  el_freebuf_t *fb = &el_free_buf;
+  int count = fb->count;
+  fb->count = 0;
+  if(count == 0 || fb->epoch != el_ctl.epoch) {
+    return 0;
+  }
+  qsort(fb->ptrs, count, sizeof(void *), el_cmp_ptr);
+  el_free_batch(fb->ptrs, count);
+  return count;
+}
+
+// Add ptr to the calling thread's buffer and flush the buffer once it
+// holds el_ctl.free_buffer blocks. Returns 1 if ptr was buffered and 0
+// if it must be freed at once; then anything buffered before buffering
+// was turned off is flushed as well.
+static int el_free_buffer_add(void *ptr){
+  el_freebuf_t *fb = &el_free_buf;
+  if(el_ctl.free_buffer == 0 || ptr == NULL || el_in_oom) {
+    if(fb->count > 0) {
+      el_free_flush();
+    }
+    return 0;
+  }
+  if(fb->count > 0 && fb->epoch != el_ctl.epoch) {
+    fb->count = 0;                      // the heap they came from is gone
+  }
+  if(fb->count == 0) {
+    fb->epoch = el_ctl.epoch;
+  }
+  if(!fb->watched) {
+    pthread_once(&el_free_buf_once, el_free_buf_key_init);
+    pthread_setspecific(el_free_buf_key, fb);
+    fb->watched = 1;
+  }
+  fb->ptrs[fb->count++] = ptr;
+  if(fb->count >= el_ctl.free_buffer) {
+    el_free_flush();
+  }
+  return 1;
+}
+
+// Retry an allocation of nbytes aligned to align (0 for none) which
+// has failed, first after freeing the blocks still pending and those
+// the calling thread has buffered and giving back the empty slab runs
+// and tiny pages kept for reuse, then after running the out-of-memory handlers.
+// Returns the block or NULL.
+static void *el_alloc_retry(size_t align, size_t nbytes){
+  size_t drained = el_defer_drain();
+  if(drained > 0) {
+    __atomic_add_fetch(&el_ctl.defer.forced, 1, __ATOMIC_RELAXED);
+  }
+  el_lock();
+  size_t released = el_slab_release_empty() + el_tiny_release_empty();
+  el_unlock();
+  if(drained + el_free_flush() + released > 0) {
+    void *ptr;
+    if(align == 0 && el_ctl.nshards > 0 && el_shard_serves(nbytes)) {
+      ptr = el_shard_malloc(nbytes);
+    }
+    else {
+      el_lock();
+      ptr = el_try_alloc(align, nbytes);
+      el_unlock_pressure();
+    }
+    if(ptr != NULL) {
+      return ptr;
+    }
+  }
+  return el_oom_retry(align, nbytes);
+}
+
+// Return a pointer to at least nbytes of usable memory or NULL if no
+// space is available even after running the out-of-memory handlers.
+// See el_tier_malloc() for which tier serves it; with the heap split
+// into shards, requests for the block lists go to el_shard_malloc().
+void *el_malloc(size_t nbytes){
+  void *ptr;
+  if(el_ctl.nshards > 0 && el_shard_serves(nbytes)) {
+    ptr = el_shard_malloc(nbytes);
+  }
+  else {
+    el_lock();
+    ptr = el_try_alloc(0, nbytes);
+    el_unlock_pressure();
+  }
+  return ptr != NULL ? ptr : el_alloc_retry(0, nbytes);
+}
+
+// Return a pointer to at least nbytes of usable memory which is a
+// multiple of align, a power of two, or NULL if no space is available
+// even after running the out-of-memory handlers.
+void *el_memalign(size_t align, size_t nbytes){
+  el_lock();
+  void *ptr = el_try_alloc(align, nbytes);
+  el_unlock_pressure();
+  return ptr != NULL ? ptr : el_alloc_retry(align, nbytes);
+}
+
+// Resize the used list block at ptr in place to hold nbytes, splitting
+// off its tail if it is shrinking and taking in the available block
+// above it if it is growing. Returns 1 on success and 0, leaving the
+// block as it was, if the block above is not available or too small or
+// the growth would cross the hard limit. The budget follows the block's
+// size. Caller must hold the heap lock.
+static int el_list_resize(void *ptr, size_t nbytes){
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  size_t old_size = block->size;
+  if(nbytes > old_size) {
+    el_blockhead_t *above = el_block_above(block);
+    if(above == NULL || above->state != EL_AVAILABLE) {
+      return 0;
+    }
+    size_t merged = old_size + EL_BLOCK_OVERHEAD + above->size;
+    size_t new_size = merged >= nbytes + EL_BLOCK_OVERHEAD ? nbytes : merged;
+    if(merged < nbytes || el_budget_refuse(new_size - old_size)) {
+      return 0;
+    }
+    el_remove_block(el_avail_list(), above);
+    el_remove_block(el_used_list(), block);
+    block->size = merged;
+    el_get_footer(block)->size = merged;
+  }
+  else {
+    el_remove_block(el_used_list(), block);
+  }
+
+  // the used list counts the block's bytes so it is off the list while
+  // its size changes
+  el_blockhead_t *rest = el_split_block(block, nbytes);
+  el_add_block_front(el_used_list(), block);
+  if(rest != NULL) {
+    rest->state = EL_AVAILABLE;
+    el_add_block_front(el_avail_list(), rest);
+    el_merge_block_with_above(rest);
+  }
+  if(block->size >= old_size) {
+    el_budget_add(block->size - old_size);
+  }
+  else {
+    el_budget_sub(old_size - block->size);
+  }
+  return 1;
+}
+
+// Change the block at ptr to hold nbytes, keeping its contents up to
+// the smaller of the old and new sizes, and return its address, which
+// is ptr if the block could be resized where it is. List blocks shrink
+// in place and grow in place into an available block above them; a
+// block from another tier stays where it is while nbytes fits it and
+// is more than half of it. Otherwise a new block is allocated, running
+// the out-of-memory handlers if need be, and the old one freed. Returns
+// NULL, leaving the block at ptr untouched, if no space is available.
+// A NULL ptr allocates and a zero nbytes frees ptr and returns NULL.
+void *el_realloc(void *ptr, size_t nbytes){
+  if(ptr == NULL) {
+    return el_malloc(nbytes);
+  }
+  if(nbytes == 0) {
+    el_free(ptr);
+    return NULL;
+  }
+  int k = el_shard_of(ptr);
+  if(k > 0) {
+    el_shard_lock(k);
+    size_t old_bytes = ((el_blockhead_t *) PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)))->size;
+    int in_place = el_list_resize(ptr, nbytes);
+    el_shard_unlock_pressure(k);
+    if(in_place) {
+      return ptr;
+    }
+    void *new_ptr = el_malloc(nbytes);
+    if(new_ptr != NULL) {
+      memcpy(new_ptr, ptr, nbytes < old_bytes ? nbytes : old_bytes);
+      el_free(ptr);
+    }
+    return new_ptr;
+  }
+  el_lock();
+  el_pageent_t ent = el_radix_get(ptr);
+  size_t old_bytes = el_block_bytes(ptr, ent);
+  int in_place = EL_PAGE_KIND(ent) == EL_PAGE_LIST ? el_list_resize(ptr, nbytes) :
+    nbytes <= old_bytes && nbytes > old_bytes / 2;
+  if(in_place) {
+    el_unlock_pressure();
+    return ptr;
+  }
+  size_t keep = nbytes < old_bytes ? nbytes : old_bytes;
+  void *new_ptr = el_try_alloc(0, nbytes);
+  if(new_ptr != NULL) {
+    memcpy(new_ptr, ptr, keep);
+    el_budget_discharge(ptr);
+    el_tier_free(ptr);
+  }
+  el_unlock_pressure();
+  if(new_ptr == NULL && (new_ptr = el_alloc_retry(0, nbytes)) != NULL) {
+    memcpy(new_ptr, ptr, keep);
+    el_free(ptr);
+  }
+  return new_ptr;
+}
+
+// Return the number of bytes usable at ptr, which came from el_malloc()
+// or a relative and may all be used: the slot size of a tiny or slab
+// block, whole pages for a span, and for a list block the size
+// el_split_block() left it, which may exceed the request by up to
+// EL_BLOCK_OVERHEAD - 1 bytes. Only the caller can change these so no
+// lock is taken. Returns 0 for NULL and pointers not in the heap.
+size_t el_malloc_usable_size(void *ptr){
+  el_pageent_t ent = el_radix_get(ptr);
+  if(ptr == NULL || EL_PAGE_KIND(ent) == EL_PAGE_NONE) {
+    return 0;
+  }
+  return el_block_bytes(ptr, ent);
+}
+
+// Return the number of usable bytes el_malloc(nbytes) would give so
+// that a growing buffer can ask for them up front: the slot size of
+// the tiny or slab class serving the request if a page or run of that
+// class has a free slot or the span region a free page to carve one
+// from, whole pages if the span region has a free span for
+// it, otherwise nbytes as the block lists would serve it. A list block
+// may turn out up to EL_BLOCK_OVERHEAD - 1 bytes larger, depending on
+// the block it is split from, and a tiny or slab request may still get
+// a slot from a page or run carved out of the list heap; see el_malloc_usable_size(). The answer reflects the heap as it is now,
+// so allocations by other threads meanwhile may change it. Returns 0
+// for 0.
+size_t el_good_size(size_t nbytes){
+  if(nbytes == 0) {
+    return 0;
+  }
+  size_t good = nbytes;
+  el_lock();
+  if(el_ctl.tiny_enabled && nbytes <= EL_TINY_MAX_SIZE) {
+    int cls = 0;
+    while(el_tiny_sizes[cls] < nbytes) {
+      cls++;
+    }
+    if(el_ctl.tiny_partial[cls] != NULL || (el_ctl.spans.pages != NULL && el_span_find(1) >= 0)) {
+      good = el_tiny_sizes[cls];
+    }
+  }
+  else if(el_ctl.slab_enabled && nbytes <= EL_SLAB_MAX_SIZE) {
+    int cls = el_ctl.slab_class_of[nbytes];
+    if(el_ctl.slab_partial[cls] != NULL || (el_ctl.spans.pages != NULL && el_span_find(1) >= 0)) {
+      good = el_ctl.slab_sizes[cls];
+    }
+  }
+  else if(el_ctl.spans.pages != NULL && nbytes >= EL_SPAN_MIN_SIZE &&
+          el_span_find((nbytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) >= 0) {
+    good = (nbytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE * EL_PAGE_SIZE;
+  }
+  el_unlock();
+  return good;
+}
+
+// Fill ptrs with up to count blocks of nbytes aligned to align, taking
+// the heap lock once for the whole batch. Returns the number of blocks
+// allocated, which is less than count only if the heap runs out; the
+// out-of-memory handlers are only run if no block at all is found. Used
+// by caches that hand out fixed-size objects without locking.
+int el_malloc_batch(size_t align, size_t nbytes, void **ptrs, int count){
+  int got = 0;
+  el_lock();
+  while(got < count && (ptrs[got] = el_try_alloc(align, nbytes)) != NULL) {
+    got++;
+  }
+  el_unlock_pressure();
+  if(got == 0 && count > 0 && (ptrs[0] = el_alloc_retry(align, nbytes)) != NULL) {
+    got = 1;
+  }
+  return got;
+}
+
+// Free memory previously returned by el_malloc() or el_memalign(),
+// under the lock of the shard it lies in. With EL_OPT_DEFER_FREE a list
+// block is only queued for the maintenance thread, unless this thread
+// is running the out-of-memory handlers which need the space at once.
+// Otherwise with EL_OPT_FREE_BUFFER it is only added to the calling
+// thread's buffer, likewise. Freeing NULL or a pointer from outside the
+// heap does nothing.
+void el_free(void *ptr){
+  if(ptr == NULL) {
+    return;
+  }
+  if(__atomic_load_n(&el_ctl.defer.interval_ms, __ATOMIC_RELAXED) > 0 && !el_in_oom && el_defer_push(ptr)) {
+    return;
+  }
+  if(el_free_buffer_add(ptr)) {
+    return;
+  }
+  int k = el_shard_of(ptr);
+  if(k > 0) {
+    el_shard_lock(k);
+    el_shard_free(ptr);
+    el_shard_unlock(k);
+    return;
+  }
+  el_lock();
+  el_budget_discharge(ptr);
+  el_tier_free(ptr);
+  el_unlock();
+}
+
+// Free ptr which the caller says was allocated with nbytes, as C++
+// sized deallocation does. The radix map already finds the tier in one
+// lookup, and the size alone could not tell a list block from a slot
+// once tiers are switched or blocks reallocated, so this is el_free()
+// with a check that a list block is at least that large.
+void el_free_sized(void *ptr, size_t nbytes){
+  assert(ptr == NULL || EL_PAGE_KIND(el_radix_get(ptr)) != EL_PAGE_LIST ||
+         ((el_blockhead_t *) PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t)))->size >= nbytes);
+  el_free(ptr);
+}
+
+// Free count blocks from ptrs under a single acquisition of the heap
+// lock, and of each other shard's lock holding any of them.
+void el_free_batch(void **ptrs, int count){
+  int in_shards = 0;
+  el_lock();
+  for(int i = 0; i < count; i++) {
+    if(el_shard_of(ptrs[i]) > 0) {
+      in_shards = 1;
+      continue;
+    }
+    el_budget_discharge(ptrs[i]);
+    el_tier_free(ptrs[i]);
+  }
+  el_unlock();
+  for(int k = 1; in_shards && k < el_ctl.nshards; k++) {
+    el_shard_lock(k);
+    for(int i = 0; i < count; i++) {
+      if(el_shard_of(ptrs[i]) == k) {
+        el_shard_free(ptrs[i]);
+      }
+    }
+    el_shard_unlock(k);
+  }
+}
+
+// Register fn to be called with arg when the bytes in use cross the
+// soft limit set with EL_OPT_SOFT_LIMIT. Returns 0 on success and -1 if
+// EL_MAX_PRESSURE_CALLBACKS are already registered.
+int el_add_pressure_callback(el_pressure_fn fn, void *arg){
+  el_budget_t *b = &el_ctl.budget;
+  int ret = -1;
+  el_lock();
+  if(b->ncallbacks < EL_MAX_PRESSURE_CALLBACKS) {
+    b->callbacks[b->ncallbacks] = fn;
+    b->callback_args[b->ncallbacks] = arg;
+    b->ncallbacks++;
+    ret = 0;
+  }
+  el_unlock();
+  return ret;
+}
+
+// Print the budget of the heap: its limits, the bytes in use and the
+// counts of soft limit crossings and hard limit failures.
+void el_print_budget(){
+  el_budget_t *b = &el_ctl.budget;
+  printf("BUDGET: {soft: %lu  hard: %lu}\n", b->soft_limit, b->hard_limit);
+  printf("  in_use: %lu  peak: %lu\n", b->in_use, b->peak);
+  printf("  soft crossings: %lu  hard failures: %lu\n", b->soft_crossings, b->hard_failures);
+}
+
+// Add fn to the end of the chain of handlers run with arg when an
+// allocation of nbytes fails. A handler returns non-zero if it may have
+// freed memory, after which the allocation is retried. Returns 0 on
+// success and -1 if EL_MAX_OOM_HANDLERS are already added.
+int el_add_oom_handler(el_oom_fn fn, void *arg){
+  el_oomchain_t *oc = &el_ctl.oom;
+  int ret = -1;
+  el_lock();
+  if(oc->nhandlers < EL_MAX_OOM_HANDLERS) {
+    oc->handlers[oc->nhandlers] = fn;
+    oc->handler_args[oc->nhandlers] = arg;
+    oc->nhandlers++;
+    ret = 0;
+  }
+  el_unlock();
+  return ret;
+}
+
+// Out-of-memory handler which gives the span region back to the list
+// heap if none of it is in use. This is one-way: the span tier stays
+// off, and its requests go to the block lists, until the application
+// carves a region again with el_mallopt(EL_OPT_SPAN_PAGES, npages),
+// say once the memory pressure has passed.
+int el_oom_purge(size_t nbytes, void *arg){
+  return el_mallopt(EL_OPT_SPAN_PAGES, 0) == 0;
+}
+
+// Out-of-memory handler which compacts handle blocks to merge the free
+// space between them.
+int el_oom_compact(size_t nbytes, void *arg){
+  return el_compact(0) > 0;
+}
+
+// Switch bounded-latency mode on or off; the heap lock must be held.
+// Switching on locks the whole heap into memory, which faults in every
+// page up front, and moves the available blocks from the size index,
+// whose pages fault in as it grows, into the real-time bins. Returns 0
+// on success and -1 if the heap cannot be locked.
+static int el_rt_set(int on){
+  if(on == el_ctl.rt_enabled) {
+    return 0;
+  }
+  size_t bytes = el_ctl.heap_bytes + EL_LOCAL_META_BYTES;
+  if(on) {
+    if(mlock(el_ctl.heap_start, bytes) != 0) {
+      return -1;
+    }
+    el_index_free();
+    memset(&el_ctl.rt_bins, 0, sizeof(el_ctl.rt_bins));
+    for(el_blockhead_t *block = el_block_next(el_list_beg(el_ctl.avail));
+        block != el_list_end(el_ctl.avail); block = el_block_next(block)) {
+      el_rt_insert(block);
+    }
+    el_ctl.rt_enabled = 1;
+  }
+  else {
+    munlock(el_ctl.heap_start, bytes);
+    el_ctl.rt_enabled = 0;
+    el_index_init(el_ctl.heap_bytes);
+    if(el_ctl.avail_index.sizes != NULL) {
+      for(el_blockhead_t *block = el_block_prev(el_list_end(el_ctl.avail));
+          block != el_list_beg(el_ctl.avail); block = el_block_prev(block)) {
+        el_index_add(block);
+      }
+    }
+  }
+  return 0;
+}
+
+// Adjust a tunable parameter of the allocator. Parameters are:
+//
+// EL_OPT_SLAB: non-zero to serve requests of EL_SLAB_MAX_SIZE bytes or
+//   less from slab runs, zero to stop, giving back the empty run each
+//   class keeps for reuse. Not available for file-backed or shared
+//   heaps as the runs are tracked in this process's el_ctl.
+//
+// EL_OPT_SLAB_TUNE: re-derive the slab classes from the sizes requested
+//   every given number of slab requests, 0 to keep them as they are.
+//   Classes start as EL_SLAB_SIZES; see el_slab_retune(). Refused in
+//   real-time mode as a re-derivation walks every run.
+//
+// EL_OPT_SPAN_PAGES: carve a span region of the given number of pages
+//   from the list heap to serve medium requests and slab runs. Only one
+//   region may exist at a time; 0 gives it back if none of it is in
+//   use, as el_oom_purge() does, after which a new one may be set. Not
+//   available for file-backed or shared heaps.
+//
+// EL_OPT_TINY: non-zero to serve requests of EL_TINY_MAX_SIZE bytes or
+//   less from header-less tiny pages, zero to stop, giving back the
+//   empty page each class keeps for reuse. Not available for
+//   file-backed or shared heaps.
+//
+// EL_OPT_SOFT_LIMIT: bytes in use beyond which the callbacks added with
+//   el_add_pressure_callback() are run, 0 for no limit.
+//
+// EL_OPT_HARD_LIMIT: bytes in use beyond which el_malloc() and friends
+//   return NULL, 0 for no limit. Refusals are counted in the budget.
+//
+// EL_OPT_REALTIME: non-zero for bounded-latency mode, zero to leave it.
+//   The heap is locked into memory and pre-faulted, available blocks
+//   are found through constant-time bins and no call maps, unmaps or
+//   advises memory: el_trim() does nothing. Freeing merges with at most
+//   the two neighbouring blocks as always. Fails if the heap cannot be
+//   locked (see RLIMIT_MEMLOCK) and, as the span region is searched
+//   linearly, while one exists; it cannot be created in this mode
+//   either. Likewise fails while EL_OPT_SLAB_TUNE is set. The tiny and
+//   slab tiers stay in use as their calls take bounded time. Not
+//   available for file-backed or shared heaps.
+//
+// EL_OPT_SHARDS: split the heap into the given number of shards, 2 to
+//   EL_MAX_SHARDS, each an equal address range with its own lists and
+//   lock; a shard's range begins with a fence block holding its lists.
+//   Threads allocate list blocks from a preferred shard, spread over
+//   them in the order they first allocate, and fall back to the others
+//   when it is full; a block is freed under the lock of the shard its
+//   address lies in. The tiers, handles, aligned and batch allocations
+//   stay in shard 0, and el_snapshot() refuses a split heap. Only an
+//   empty heap can be split, not in real-time mode nor with a span
+//   region, and a split is kept until el_cleanup(). Not available for
+//   file-backed or shared heaps.
+//
+// EL_OPT_DEFER_FREE: milliseconds between passes of a maintenance
+//   thread which frees, merges and files the list blocks el_free()
+//   has queued and then trims the heap, or 0 to stop it and free list
+//   blocks at once again. An allocation which fails frees the queue
+//   itself before running the out-of-memory handlers. Bytes in use
+//   include queued blocks until they are freed. Not available for
+//   file-backed or shared heaps.
+//
+// EL_OPT_FREE_BUFFER: number of blocks, up to EL_FREE_BUFFER_MAX, which
+//   each thread's el_free() gathers before freeing them together with
+//   el_free_flush(), 0 to free at once. A thread's buffer is flushed
+//   when it exits and when an allocation of its fails; other threads'
+//   buffers are out of reach. Bytes in use include buffered blocks.
+//   Frees deferred with EL_OPT_DEFER_FREE are not buffered.
+//
+// Bytes in use are the usable bytes of blocks from el_malloc(),
+// el_memalign() and el_malloc_batch() which have not been freed, as
+// seen by this process.
+//
+// Returns 0 on success and -1 for an unknown parameter or bad value.
+int el_mallopt(int param, long value){
+  if(param == EL_OPT_DEFER_FREE) {
+    return el_defer_set(value);         // joins the thread so takes no heap lock
+  }
+  int ret = 0;
+  el_lock();
+  switch(param) {
+  case EL_OPT_SLAB:
+    if(value != 0 && el_ctl.meta != NULL) {
+      ret = -1;
+    }
+    else {
+      if(value != 0 && el_ctl.slab_sizes[EL_SLAB_CLASSES - 1] == 0) {
+        el_slab_set_classes(el_slab_default_sizes);
+      }
+      if(value == 0) {
+        el_slab_release_empty();
+      }
+      el_ctl.slab_enabled = (value != 0);
+    }
+    break;
+  case EL_OPT_SLAB_TUNE:
+    if(value < 0 || (value > 0 && el_ctl.rt_enabled)) {
+      ret = -1;
+    }
+    else {
+      el_ctl.slab_tune_period = value;
+      el_ctl.slab_tune_count = 0;
+    }
+    break;
+  case EL_OPT_TINY:
+    if(value != 0 && el_ctl.meta != NULL) {
+      ret = -1;
+    }
+    else {
+      if(value == 0) {
+        el_tiny_release_empty();
+      }
+      el_ctl.tiny_enabled = (value != 0);
+    }
+    break;
+  case EL_OPT_SPAN_PAGES:
+    if(value == 0 && el_ctl.spans.pages != NULL) {
+      el_slab_release_empty();          // kept for reuse, not in use
+      el_tiny_release_empty();
+    }
+    if(value > 0 && el_ctl.spans.pages == NULL && el_ctl.meta == NULL && !el_ctl.rt_enabled) {
+      ret = el_span_init(value);
+    }
+    else if(value == 0 && el_ctl.spans.pages != NULL &&
+            EL_SPAN(0)->state == EL_SPAN_FREE && EL_SPAN(0)->npages == el_ctl.spans.npages) {
+      el_radix_set(el_ctl.spans.pages, el_ctl.spans.npages, EL_PAGE_LIST);
+      el_list_free(el_ctl.spans.pages);
+      el_list_free(el_ctl.spans.spans);
+      el_list_free(el_ctl.spans.pagemap);
+      el_ctl.spans.pages = NULL;
+    }
+    else {
+      ret = -1;
+    }
+    break;
+  case EL_OPT_REALTIME:
+    if(value != 0 && (el_ctl.meta != NULL || el_ctl.spans.pages != NULL || el_ctl.nshards > 0 ||
+                      el_ctl.slab_tune_period != 0)) {
+      ret = -1;
+    }
+    else {
+      ret = el_rt_set(value != 0);
+    }
+    break;
+  case EL_OPT_SHARDS:
+    ret = el_shard_split(value);
+    break;
+  case EL_OPT_FREE_BUFFER:
+    if(value < 0 || value > EL_FREE_BUFFER_MAX) {
+      ret = -1;
+    }
+    else {
+      el_ctl.free_buffer = value;
+    }
+    break;
+  case EL_OPT_SOFT_LIMIT:
+    el_ctl.budget.soft_limit = value < 0 ? 0 : value;
+    ret = value < 0 ? -1 : 0;
+    break;
+  case EL_OPT_HARD_LIMIT:
+    el_ctl.budget.hard_limit = value < 0 ? 0 : value;
+    ret = value < 0 ? -1 : 0;
+    break;
+  default:
+    ret = -1;
+  }
+  el_unlock();
+  return ret;
+}
+
+
+// Relocatable allocations and compaction
+
+// Return the handle stored in the first word of a handle block.
+static el_handle_t el_block_handle(el_blockhead_t *block) {
+  return *(el_handle_t *) PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+}
+
+// Allocate nbytes of memory which the allocator may later move to
+// reduce fragmentation and return a handle for it. The memory is
+// reached through el_hpin(). Returns EL_NO_HANDLE if no space or no
+// free handle is available.
+el_handle_t el_halloc(size_t nbytes){
+  el_lock();
+  el_handle_t handle;
+  for(handle = 0; handle < EL_MAX_HANDLES; handle++) {
+    if(el_ctl.handles[handle].block == NULL) {
+      break;
+    }
+  }
+  void *ptr = NULL;
+  if(handle < EL_MAX_HANDLES) {
+    ptr = el_list_malloc(nbytes + sizeof(el_handle_t));
+  }
+  if(ptr == NULL) {
+    el_unlock();
+    return EL_NO_HANDLE;
+  }
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  block->state = EL_USED_HANDLE;
+  *(el_handle_t *) ptr = handle;
+  el_ctl.handles[handle].block = block;
+  el_ctl.handles[handle].pins = 0;
+  el_unlock();
+  return handle;
+}
+
+// Return the table entry of handle, or NULL if handle is outside the
+// table, such as EL_NO_HANDLE, or has been freed. Caller must hold the
+// heap lock.
+static el_handleent_t *el_handle_entry(el_handle_t handle){
+  if(handle < 0 || handle >= EL_MAX_HANDLES || el_ctl.handles[handle].block == NULL) {
+    return NULL;
+  }
+  return &el_ctl.handles[handle];
+}
+
+// Pin the memory of a handle in place and return its current address.
+// The address stays valid until the matching el_hunpin(). Returns NULL
+// for a handle which is not in use.
+void *el_hpin(el_handle_t handle){
+  el_lock();
+  el_handleent_t *ent = el_handle_entry(handle);
+  void *ptr = NULL;
+  if(ent != NULL) {
+    ent->pins++;
+    ptr = PTR_PLUS_BYTES(ent->block, sizeof(el_blockhead_t) + sizeof(el_handle_t));
+  }
+  el_unlock();
+  return ptr;
+}
+
+// Release one pin on a handle; once all pins are released the memory
+// may be moved by el_compact(). Does nothing for a handle which is not
+// in use or not pinned.
+void el_hunpin(el_handle_t handle){
+  el_lock();
+  el_handleent_t *ent = el_handle_entry(handle);
+  if(ent != NULL && ent->pins > 0) {
+    ent->pins--;
+  }
+  el_unlock();
+}
+
+// Free the memory of a handle and the handle itself. Does nothing for
+// a handle which is not in use.
+void el_hfree(el_handle_t handle){
+  el_lock();
+  el_handleent_t *ent = el_handle_entry(handle);
+  if(ent != NULL) {
+    el_list_free(PTR_PLUS_BYTES(ent->block, sizeof(el_blockhead_t)));
+    ent->block = NULL;
+    ent->pins = 0;
+  }
+  el_unlock();
+}
+
+// Move the handle block 'higher' down into the available block 'lower'
+// which sits immediately below it. Afterwards the handle block starts at
+// lower's address and the free space lies above it, merged with any
+// available block beyond. Returns the resulting available block.
+static el_blockhead_t *el_slide_block(el_blockhead_t *lower, el_blockhead_t *higher){
+  size_t free_size = lower->size;
+  el_handle_t handle = el_block_handle(higher);
+
+  el_remove_block(el_ctl.avail, lower);
+  el_remove_block(el_ctl.used, higher);
+
+  // copy header, data and footer in one go; the regions may overlap
+  memmove(lower, higher, higher->size + EL_BLOCK_OVERHEAD);
+  el_blockhead_t *moved = lower;
+  el_add_block_front(el_ctl.used, moved);
+  el_ctl.handles[handle].block = moved;
+
+  el_blockhead_t *hole = el_block_above(moved);
+  hole->size = free_size;
+  hole->state = EL_AVAILABLE;
+  el_get_footer(hole)->size = free_size;
+  el_add_block_front(el_ctl.avail, hole);
+  el_merge_block_with_above(hole);
+  return hole;
+}
+
+// Compact the heap by sliding unpinned handle blocks down toward
+// heap_start into the available blocks below them, which gathers free
+// space toward the end of the heap. Ordinary el_malloc() blocks and
+// pinned handle blocks stay put. At most max_moves blocks are moved so
+// that the work can be spread over several calls; 0 means no limit.
+// Finishes by trimming the heap with el_trim(). Returns the number of
+// blocks moved.
+size_t el_compact(size_t max_moves){
+  el_lock();
+  size_t moved = 0;
+  el_blockhead_t *block = el_ctl.heap_start;
+  void *end = el_shard_end(0);          // handle blocks are all in shard 0
+  while(block != NULL && (void *) block < end && (max_moves == 0 || moved < max_moves)) {
+    el_blockhead_t *above = el_block_above(block);
+    if(block->state == EL_AVAILABLE && above != NULL && above->state == EL_USED_HANDLE) {
+      el_handle_t handle = el_block_handle(above);
+      // only blocks of this process's handles which are unpinned move;
+      // in a shared heap another process may own the handle
+      if(handle >= 0 && handle < EL_MAX_HANDLES &&
+         el_ctl.handles[handle].block == above && el_ctl.handles[handle].pins == 0) {
+        block = el_slide_block(block, above);
+        moved++;
+        continue;
+      }
+    }
+    block = above;
+  }
+  el_unlock();
+  el_trim();
+  return moved;
+}
+
+// Set the bits of the npages pages from addr in the bitmap of released
+// pages, mapping it first if need be, so that el_resident() can tell
+// them from pages never touched. Without the bitmap they are reported
+// as never touched.
+static void el_mark_purged(void *addr, size_t npages){
+  if(el_ctl.purged == NULL) {
+    void *map = mmap(NULL, el_purged_bytes(el_ctl.heap_bytes), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(map == MAP_FAILED) {
+      return;
+    }
+    el_ctl.purged = map;
+  }
+  size_t first = PTR_MINUS_PTR(addr, el_ctl.heap_start) / EL_PAGE_SIZE;
+  for(size_t p = first; p < first + npages; p++) {
+    el_ctl.purged[p / 64] |= 1UL << (p % 64);
+  }
+}
+
+// Return the whole pages inside the block ending at end, the end of the
+// heap or of a shard, to the operating system if that block is
+// available; the lock of the shard must be held. Returns the number of
+// bytes released.
+static size_t el_trim_below(void *end_ptr){
+  el_blockfoot_t *foot = PTR_MINUS_BYTES(end_ptr, sizeof(el_blockfoot_t));
+  el_blockhead_t *last = el_get_header(foot);
+  size_t bytes = 0;
+  // pages stay resident in real-time mode; trimming would also wipe the
+  // bin links in the block
+  if(last->state == EL_AVAILABLE && !el_ctl.rt_enabled) {
+    size_t beg = (size_t) PTR_PLUS_BYTES(last, sizeof(el_blockhead_t));
+    beg = ((beg + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) * EL_PAGE_SIZE;
+    size_t end = ((size_t) foot / EL_PAGE_SIZE) * EL_PAGE_SIZE;
+    if(end > beg) {
+      bytes = end - beg;
+      // pages of a file or shared heap must be removed from the backing
+      // object as well for the memory to be released
+      madvise((void *) beg, bytes, el_ctl.meta != NULL ? MADV_REMOVE : MADV_DONTNEED);
+      el_mark_purged((void *) beg, bytes / EL_PAGE_SIZE);
+    }
+  }
+  return bytes;
+}
+
+// Return the whole pages inside the last block of the heap, or of each
+// shard, to the operating system if that block is available. The block
+// stays on the available list; its pages read back as zeros when next
+// used. Returns the number of bytes released.
+size_t el_trim(){
+  el_lock();
+  size_t bytes = el_trim_below(el_shard_end(0));
+  for(int k = 1; k < el_ctl.nshards; k++) {
+    el_shard_lock(k);
+    bytes += el_trim_below(el_shard_end(k));
+    el_shard_unlock(k);
+  }
+  el_unlock();
+  return bytes;
+}
+
+// Residency accounting
+
+// Add page, one of the heap's pages, to res under used or free. A page
+// of the span region goes by the state of its span instead. The page's
+// byte from mincore() says whether it is resident; one which is clears
+// any mark of it having been released, as it has been touched since.
+static void el_resident_page(el_residency_t *res, const unsigned char *vec, size_t page, int used){
+  void *addr = PTR_PLUS_BYTES(el_ctl.heap_start, page * EL_PAGE_SIZE);
+  int span = el_span_of(addr);
+  if(span >= 0) {
+    used = EL_SPAN(span)->state != EL_SPAN_FREE;
+  }
+  int kind = used ? EL_RES_USED : EL_RES_FREE;
+  unsigned long bit = 1UL << (page % 64);
+  if(vec[page] & 1) {
+    res->resident[kind] += EL_PAGE_SIZE;
+    if(el_ctl.purged != NULL) {
+      el_ctl.purged[page / 64] &= ~bit;
+    }
+  }
+  else if(el_ctl.purged != NULL && (el_ctl.purged[page / 64] & bit)) {
+    res->purged[kind] += EL_PAGE_SIZE;
+  }
+  else {
+    res->untouched[kind] += EL_PAGE_SIZE;
+  }
+}
+
+// Sum the transparent huge pages backing the heap from the
+// AnonHugePages lines of the heap's mappings in /proc/self/smaps.
+// mincore() does not tell page sizes apart so this is only known for
+// the heap as a whole. Returns 0 if the figure is unavailable.
+static size_t el_resident_huge(){
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if(smaps == NULL) {
+    return 0;
+  }
+  char line[256];
+  int in_heap = 0;
+  size_t kb = 0, huge = 0;
+  while(fgets(line, sizeof(line), smaps) != NULL) {
+    unsigned long beg, end;
+    if(sscanf(line, "%lx-%lx ", &beg, &end) == 2) {
+      in_heap = beg < (unsigned long) el_ctl.heap_end && end > (unsigned long) el_ctl.heap_start;
+    }
+    else if(in_heap && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+      huge += kb * 1024;
+    }
+  }
+  fclose(smaps);
+  return huge;
+}
+
+// Release the locks taken by el_resident().
+static void el_resident_unlock(){
+  for(int k = el_ctl.nshards - 1; k > 0; k--) {
+    pthread_mutex_unlock(&el_ctl.shards[k].lock);
+  }
+  el_unlock();
+}
+
+// Fill res with how much of the heap is resident, released by
+// el_trim(), never touched and backed by huge pages, split between
+// pages holding used blocks and pages wholly inside available blocks.
+// A page is classed by the blocks overlapping it, found by walking the
+// heap in address order, and its residency comes from mincore(). Holds
+// the heap lock, and the lock of every other shard, throughout. Returns
+// 0 on success and -1 on failure.
+int el_resident(el_residency_t *res){
+  memset(res, 0, sizeof(*res));
+  el_lock();
+  for(int k = 1; k < el_ctl.nshards; k++) {
+    pthread_mutex_lock(&el_ctl.shards[k].lock);
+  }
+  size_t npages = (el_ctl.heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE;
+  unsigned char *vec = mmap(NULL, npages, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(vec == MAP_FAILED || mincore(el_ctl.heap_start, el_ctl.heap_bytes, vec) != 0) {
+    if(vec != MAP_FAILED) {
+      munmap(vec, npages);
+    }
+    el_resident_unlock();
+    return -1;
+  }
+
+  // a page shared by several blocks is held until the last of them has
+  // been seen and counts as used if any of them is
+  size_t pending = npages;
+  int pending_used = 0;
+  for(el_blockhead_t *block = el_ctl.heap_start; block != NULL; block = el_block_above(block)) {
+    size_t beg = PTR_MINUS_PTR(block, el_ctl.heap_start);
+    size_t end = beg + block->size + EL_BLOCK_OVERHEAD;
+    int used = block->state != EL_AVAILABLE;
+    for(size_t page = beg / EL_PAGE_SIZE; page <= (end - 1) / EL_PAGE_SIZE; page++) {
+      if(page == pending) {
+        pending_used |= used;
+        continue;
+      }
+      if(pending < npages) {
+        el_resident_page(res, vec, pending, pending_used);
+      }
+      pending = page;
+      pending_used = used;
+    }
+  }
+  if(pending < npages) {
+    el_resident_page(res, vec, pending, pending_used);
+  }
+  munmap(vec, npages);
+  el_resident_unlock();
+  res->huge = el_resident_huge();
+  return 0;
+}
+
+// Print the residency of the heap from el_resident(). The format
+// appears as follows.
+//
+// RESIDENT: {huge: 0}
+//   used: resident:     8192  purged:        0  untouched:        0
+//   free: resident:     4096  purged:    40960  untouched:   209920
+void el_print_resident(){
+  el_residency_t res;
+  if(el_resident(&res) != 0) {
+    printf("RESIDENT: unavailable\n");
+    return;
+  }
+  printf("RESIDENT: {huge: %lu}\n", res.huge);
+  const char *names[2] = {"used", "free"};
+  for(int kind = EL_RES_USED; kind <= EL_RES_FREE; kind++) {
+    printf("  %s: resident: %8lu  purged: %8lu  untouched: %8lu\n", names[kind],
+           res.resident[kind], res.purged[kind], res.untouched[kind]);
+  }
+}
+
+
+// Heap snapshots
+
+// Header at the start of a snapshot file written by el_snapshot(). It
+// is followed, at offset EL_SNAPSHOT_HEADER_BYTES, by the first
+// image_bytes of the heap. Anything beyond that is the inside of the
+// final available block which need not be saved.
+typedef struct {
+  unsigned long magic;          // EL_HEAP_MAGIC
+  size_t heap_bytes;            // size of the heap the snapshot was taken of
+  size_t image_bytes;           // bytes of heap saved in the file, a whole number of pages
+  size_t last_offset;           // offset from heap_start of the final block
+  el_blocklist_t avail;         // copy of the available list
+  el_blocklist_t used;          // copy of the used list
+  el_handleent_t handles[EL_MAX_HANDLES]; // copy of the handle table
+  el_slabrun_t *slab_partial[EL_SLAB_CLASSES]; // copy of the slab run lists
+  el_slabrun_t *slab_empty[EL_SLAB_CLASSES]; // copy of the empty run kept for each class
+  el_slabrun_t *slab_all;       // copy of the chain of all slab runs
+  size_t slab_runs;             // copy of the number of slab runs
+  int slab_enabled;             // copy of the slab tier setting
+  size_t slab_sizes[EL_SLAB_CLASSES]; // copy of the slab class sizes
+  el_spanheap_t spans;          // copy of the span region state
+  int tiny_enabled;             // copy of the tiny tier setting
+  el_tinypage_t *tiny_partial[EL_TINY_CLASSES]; // copy of the tiny page lists
+  el_tinypage_t *tiny_all;      // copy of the chain of all tiny pages
+  el_tinypage_t *tiny_empty[EL_TINY_CLASSES]; // copy of the empty page kept for each class
+} el_snapshot_t;
+
+#define EL_SNAPSHOT_HEADER_BYTES \
+  (((sizeof(el_snapshot_t) + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) * EL_PAGE_SIZE)
+
+// Write the in-use portion of the heap and the el_ctl state needed to
+// rebuild it to the file at path so that it can be brought back with
+// el_restore(). Returns 0 on success and -1 on failure, which includes
+// a heap split into shards.
+int el_snapshot(const char *path){
+  if(el_ctl.nshards > 0) {
+    fprintf(stderr, "el_snapshot: heap is split into shards\n");
+    return -1;
+  }
+  el_defer_drain();                     // queued blocks would be saved as used
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    perror("el_snapshot: open");
+    return -1;
+  }
+
+  el_lock();
+  el_snapshot_t *snap = calloc(1, sizeof(el_snapshot_t));
+  snap->magic = EL_HEAP_MAGIC;
+  snap->heap_bytes = el_ctl.heap_bytes;
+  snap->avail = *el_ctl.avail;
+  snap->used = *el_ctl.used;
+  memcpy(snap->handles, el_ctl.handles, sizeof(snap->handles));
+  memcpy(snap->slab_partial, el_ctl.slab_partial, sizeof(snap->slab_partial));
+  memcpy(snap->slab_empty, el_ctl.slab_empty, sizeof(snap->slab_empty));
+  snap->slab_runs = el_ctl.slab_runs;
+  snap->slab_all = el_ctl.slab_all;
+  snap->slab_enabled = el_ctl.slab_enabled;
+  memcpy(snap->slab_sizes, el_ctl.slab_sizes, sizeof(snap->slab_sizes));
+  snap->spans = el_ctl.spans;
+  snap->tiny_enabled = el_ctl.tiny_enabled;
+  memcpy(snap->tiny_partial, el_ctl.tiny_partial, sizeof(snap->tiny_partial));
+  snap->tiny_all = el_ctl.tiny_all;
+  memcpy(snap->tiny_empty, el_ctl.tiny_empty, sizeof(snap->tiny_empty));
+
+  // the data of a trailing available block is not needed, only its header
+  el_blockfoot_t *foot = PTR_MINUS_BYTES(el_ctl.heap_end, sizeof(el_blockfoot_t));
+  el_blockhead_t *last = el_get_header(foot);
+  snap->last_offset = PTR_MINUS_PTR(last, el_ctl.heap_start);
+  size_t image_bytes = el_ctl.heap_bytes;
+  if(last->state == EL_AVAILABLE) {
+    image_bytes = snap->last_offset + sizeof(el_blockhead_t);
+  }
+  image_bytes = ((image_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) * EL_PAGE_SIZE;
+  if(image_bytes > el_ctl.heap_bytes) {
+    image_bytes = el_ctl.heap_bytes;
+  }
+  snap->image_bytes = image_bytes;
+
+  int ret = 0;
+  if(pwrite(fd, snap, sizeof(el_snapshot_t), 0) != sizeof(el_snapshot_t) ||
+     pwrite(fd, el_ctl.heap_start, image_bytes, EL_SNAPSHOT_HEADER_BYTES) != image_bytes) {
+    perror("el_snapshot: write");
+    ret = -1;
+  }
+  el_unlock();
+  free(snap);
+  close(fd);
+  return ret;
+}
+
+// Make a copy of the saved list 'saved' in list and repair the links
+// between its end nodes and its first/last blocks which still refer to
+// the saved list's end nodes.
+static void el_relink_blocklist(el_blocklist_t *list, el_blocklist_t *saved){
+  *list = *saved;
+  el_list_set_ends(list);
+  el_blockhead_t *first = el_block_next(el_list_beg(list));
+  if(first == el_list_end(saved)) {
+    el_block_set_next(el_list_beg(list), el_list_end(list));
+    el_block_set_prev(el_list_end(list), el_list_beg(list));
+  }
+  else {
+    el_block_set_prev(first, el_list_beg(list));
+    el_block_set_next(el_block_prev(el_list_end(list)), el_list_end(list));
+  }
+}
+
+// Restore a heap saved by el_snapshot() in place of el_init(). The
+// saved image is mapped privately from the file at EL_HEAP_START_ADDRESS
+// so its pages are only read in when first touched and changes are not
+// written back; the rest of the heap is fresh anonymous memory. Returns
+// 0 on success and -1 on failure.
+int el_restore(const char *path){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    perror("el_restore: open");
+    return -1;
+  }
+  el_snapshot_t *snap = malloc(sizeof(el_snapshot_t));
+  if(pread(fd, snap, sizeof(el_snapshot_t), 0) != sizeof(el_snapshot_t) ||
+     snap->magic != EL_HEAP_MAGIC) {
+    fprintf(stderr,"el_restore: %s is not a heap snapshot\n", path);
+    free(snap);
+    close(fd);
+    return -1;
+  }
+
+  void *heap = mmap(EL_HEAP_START_ADDRESS, snap->image_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE, fd, EL_SNAPSHOT_HEADER_BYTES);
+  close(fd);
+  size_t rest_bytes = snap->heap_bytes - snap->image_bytes + EL_LOCAL_META_BYTES;
+  void *rest = PTR_PLUS_BYTES(EL_HEAP_START_ADDRESS, snap->image_bytes);
+  if(heap == EL_HEAP_START_ADDRESS && rest_bytes > 0) {
+    rest = mmap(rest, rest_bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if(heap != EL_HEAP_START_ADDRESS || rest != PTR_PLUS_BYTES(EL_HEAP_START_ADDRESS, snap->image_bytes)) {
+    fprintf(stderr,"el_restore: could not map %s at %p\n", path, EL_HEAP_START_ADDRESS);
+    if(heap != MAP_FAILED) {
+      munmap(heap, snap->image_bytes);
+    }
+    if(rest != MAP_FAILED && rest_bytes > 0) {
+      munmap(rest, rest_bytes);
+    }
+    free(snap);
+    return -1;
+  }
+
+  el_ctl.heap_bytes = snap->heap_bytes;
+  el_ctl.heap_start = heap;
+  el_ctl.heap_end = PTR_PLUS_BYTES(heap, snap->heap_bytes);
+  el_ctl.meta = NULL;
+  el_ctl.heap_shared = 0;
+  pthread_mutex_init(&el_ctl.lock_actual, NULL);
+  el_ctl.lock = &el_ctl.lock_actual;
+  el_watch_fork();
+#ifdef EL_OFFSET_LINKS
+  el_heapmeta_t *meta = PTR_PLUS_BYTES(heap, snap->heap_bytes);
+  el_ctl.avail = &meta->avail_actual;
+  el_ctl.used = &meta->used_actual;
+#else
+  el_ctl.avail = &el_ctl.avail_actual;
+  el_ctl.used = &el_ctl.used_actual;
+#endif
+  el_relink_blocklist(el_ctl.avail, &snap->avail);
+  el_relink_blocklist(el_ctl.used, &snap->used);
+
+  // fill the size index oldest block first, i.e. from the list's end
+  el_index_init(snap->heap_bytes);
+  if(el_ctl.avail_index.sizes != NULL) {
+    for(el_blockhead_t *block = el_block_prev(el_list_end(el_ctl.avail));
+        block != el_list_beg(el_ctl.avail); block = el_block_prev(block)) {
+      el_index_add(block);
+    }
+  }
+  memcpy(el_ctl.handles, snap->handles, sizeof(el_ctl.handles));
+  memcpy(el_ctl.slab_partial, snap->slab_partial, sizeof(el_ctl.slab_partial));
+  memcpy(el_ctl.slab_empty, snap->slab_empty, sizeof(el_ctl.slab_empty));
+  el_ctl.slab_runs = snap->slab_runs;
+  el_ctl.slab_enabled = snap->slab_enabled;
+  memcpy(el_ctl.slab_sizes, snap->slab_sizes, sizeof(el_ctl.slab_sizes));
+  if(el_ctl.slab_sizes[EL_SLAB_CLASSES - 1] != 0) {
+    el_slab_index_classes();
+  }
+  el_ctl.spans = snap->spans;
+  el_ctl.slab_all = snap->slab_all;
+
+  // register the restored pages in the radix map; only the slab runs
+  // and tiny page metadata need to be read to do so
+  el_radix_set(heap, (snap->heap_bytes + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE, EL_PAGE_LIST);
+  if(el_ctl.spans.pages != NULL) {
+    el_radix_set(el_ctl.spans.pages, el_ctl.spans.npages, EL_PAGE_SPAN);
+  }
+  for(el_slabrun_t *run = el_ctl.slab_all; run != NULL; run = run->all_next) {
+    el_radix_set(run, 1, EL_PAGE_SLAB | (el_pageent_t) run);
+  }
+  el_ctl.tiny_enabled = snap->tiny_enabled;
+  memcpy(el_ctl.tiny_partial, snap->tiny_partial, sizeof(el_ctl.tiny_partial));
+  el_ctl.tiny_all = snap->tiny_all;
+  memcpy(el_ctl.tiny_empty, snap->tiny_empty, sizeof(el_ctl.tiny_empty));
+  for(el_tinypage_t *tp = el_ctl.tiny_all; tp != NULL; tp = tp->all_next) {
+    el_radix_set(tp->page, 1, EL_PAGE_TINY | (el_pageent_t) tp);
+  }
+
+  // the final block's footer may lie beyond the saved image
+  el_blockhead_t *last = PTR_PLUS_BYTES(heap, snap->last_offset);
+  el_get_footer(last)->size = last->size;
+  free(snap);
+  return 0;
+}
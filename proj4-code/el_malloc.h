@@ -1,6 +1,13 @@
 #ifndef EL_MALLOC_H
 #define EL_MALLOC_H
 
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef __cplusplus                     // C++ callers, see el_malloc.hpp
+extern "C" {
+#endif
+
 // macro to add a byte offset to a pointer, arguments are a pointer
 // and a number of bytes (usually size_t)
 #define PTR_PLUS_BYTES(ptr, off) ((void *) (((size_t) (ptr)) + ((size_t) (off))))
@@ -16,12 +23,20 @@
 // Basic defines for the default size/starting place of the heap
 #define EL_HEAP_START_ADDRESS ((void *) 0x0000600000000000)
 #define EL_HEAP_INITIAL_SIZE  ((size_t) 4096)
+#define EL_PAGE_SIZE          ((size_t) 4096)
+
+// Magic number written into the metadata of file-backed heaps so that
+// a reopened file can be recognized as a heap image
+#define EL_HEAP_MAGIC         0x656c68656170UL   // "elheap"
 
 // defines to indicate if a block is available or used
 #define EL_AVAILABLE     'a'    // block state indicating available
 #define EL_USED          'u'    // block state indicating in use
+#define EL_USED_HANDLE   'h'    // block state indicating in use through a handle; may be moved
 #define EL_BEGIN_BLOCK   'B'    // block state indicating dummy beginning node in a list
 #define EL_END_BLOCK     'E'    // block state indicating dummy ending node in a list
+#define EL_FENCE         'f'    // block state indicating a fence between shards
+#define EL_PENDING       'p'    // block state indicating freed but not yet merged, see EL_OPT_DEFER_FREE
 #define EL_UNINITIALIZED  0     // indication of uninitialized data
 
 // type which is a "header" for a block of memory; contains info on
@@ -29,12 +44,29 @@
 // next/prev blocks in a doubly linked list. This data structure
 // appears immediately before a block of memory that is tracked by the
 // allocator.
+//
+// When compiled with EL_OFFSET_LINKS the links are instead 32-bit byte
+// offsets from heap_start. This shrinks the header by 8 bytes and makes
+// a heap image independent of the address it is mapped at, but limits
+// the heap (plus its metadata) to under 4 GiB. Links should always be
+// accessed with el_block_next() and friends which work in both layouts.
+#ifdef EL_OFFSET_LINKS
+typedef struct block {
+  size_t size;                  // number of bytes of memory in this block
+  char state;                   // either EL_AVAILABLE or EL_USED
+  uint32_t next;                // offset from heap_start of next block in same list
+  uint32_t prev;                // offset from heap_start of previous block in same list
+} el_blockhead_t;
+
+#define EL_NULL_LINK UINT32_MAX // offset link value representing NULL
+#else
 typedef struct block {
   size_t size;                  // number of bytes of memory in this block
   char state;                   // either EL_AVAILABLE or EL_USED
   struct block *next;           // pointer to next block in same list
   struct block *prev;           // pointer to previous block in same list
 } el_blockhead_t;
+#endif
 
 // Type for the "footer" of a block; indicates size of the preceding
 // block so that its header el_blockhead_t can be found with pointer
@@ -51,17 +83,314 @@ typedef struct {
 
 // Type for a list of blocks; doubly linked with a fixed
 // "dummy" node at the beginning and end which do not contain any
-// data. List tracks its length and number of bytes in use.
+// data. List tracks its length and number of bytes in use. The links
+// to the end nodes take the same form as block links, so a list kept
+// in a heap file or shared heap stays valid wherever it is mapped;
+// access them with el_list_beg() and el_list_end().
 typedef struct {
   el_blockhead_t beg_actual;    // fixed node at beginning of list; state is EL_BEGIN_BLOCK
   el_blockhead_t end_actual;    // fixed node at end of list; state is EL_END_BLOCK
+#ifdef EL_OFFSET_LINKS
+  uint32_t beg;                 // offset from heap_start of beg_actual
+  uint32_t end;                 // offset from heap_start of end_actual
+#else
   el_blockhead_t *beg;          // pointer to beg_actual
   el_blockhead_t *end;          // pointer to end_actual
+#endif
   size_t length;                // length of the used block list (not counting beg/end)
   size_t bytes;                 // total bytes in list used including overhead;
 } el_blocklist_t;
 // NOTE: total available bytes for/in use in the list is (bytes - length*EL_BLOCK_OVERHEAD)
 
+// Handles name relocatable allocations made with el_halloc(). A handle
+// is an index into el_ctl.handles; the block it refers to may be moved
+// by el_compact() whenever it is not pinned so its address must be
+// obtained afresh with el_hpin() before each use.
+typedef long el_handle_t;
+#define EL_NO_HANDLE     ((el_handle_t) -1) // returned when no handle could be made
+#define EL_MAX_HANDLES   1024               // number of entries in the handle table
+
+// Entry in the handle table. The first word of a handle block's memory
+// holds its handle so the compactor can find the entry for a block.
+typedef struct {
+  el_blockhead_t *block;        // block the handle refers to, NULL if the entry is free
+  int pins;                     // number of outstanding el_hpin() calls
+} el_handleent_t;
+
+// Slab tier: requests of up to EL_SLAB_MAX_SIZE bytes may be served
+// from slab runs rather than blocks of their own (see el_mallopt()). A
+// run is one page-aligned page taken from the list heap holding a
+// header followed by equal sized slots of one size class. A bitmap in
+// the header tracks which slots are free. Slots carry no per-object
+// header so a small object costs only its slot.
+#define EL_SLAB_RUN_BYTES  EL_PAGE_SIZE                 // size and alignment of a run
+#define EL_SLAB_MAGIC      0x736c616272756eUL           // "slabrun", marks a run header
+#ifdef EL_SLAB_CONFIG                                   // header from el_size_classes
+#include EL_SLAB_CONFIG
+#endif
+#ifndef EL_SLAB_SIZES                                   // may be given together at compile time
+#define EL_SLAB_SIZES      {16, 32, 64, 128, 256}       // slot size of each class
+#define EL_SLAB_CLASSES    5                            // number of slab classes
+#define EL_SLAB_MAX_SIZE   256                          // largest request served from slabs
+#endif
+#define EL_SLAB_BITMAP_WORDS (EL_SLAB_RUN_BYTES / 8 / 64) // enough bits for 8-byte slots
+#define EL_SLAB_RETIRED    (-1)                         // cls of a run left over from earlier classes
+#define EL_SLAB_TUNE_ALIGN 16                           // slot sizes chosen by tuning are multiples of this
+
+// Type for the header at the start of every slab run.
+typedef struct el_slabrun {
+  unsigned long magic;          // EL_SLAB_MAGIC while the run is live
+  struct el_slabrun *self;      // address of this run; guards against stray magic values
+  struct el_slabrun *next;      // next run of this class with free slots
+  struct el_slabrun *prev;      // previous run of this class with free slots
+  size_t slot_size;             // bytes in each slot
+  int cls;                      // index of the slab class or EL_SLAB_RETIRED
+  int nslots;                   // number of slots in the run
+  int nfree;                    // number of free slots
+  struct el_slabrun *all_next;  // next run in the chain of all live runs
+  struct el_slabrun *all_prev;  // previous run in the chain of all live runs
+  unsigned long bitmap[EL_SLAB_BITMAP_WORDS]; // 1 bits mark free slots
+} el_slabrun_t;
+
+// Tiny tier: requests of up to EL_TINY_MAX_SIZE bytes may be served
+// from tiny pages (see el_mallopt()). Unlike a slab run a tiny page has
+// no header: every byte of the page is slots of one size class and the
+// class and free bitmap live in a separate el_tinypage_t found through
+// the radix map, so objects as small as 8 bytes carry no overhead in
+// the page at all.
+#define EL_TINY_SIZES      {8, 16, 24, 32, 48, 64} // slot size of each class
+#define EL_TINY_CLASSES    6                       // number of tiny classes
+#define EL_TINY_MAX_SIZE   64                      // largest request served from tiny pages
+#define EL_TINY_BITMAP_WORDS (EL_PAGE_SIZE / 8 / 64)
+
+// Type for the metadata of a tiny page, kept in the list heap.
+typedef struct el_tinypage {
+  void *page;                   // the page of slots
+  struct el_tinypage *next;     // next page of this class with free slots
+  struct el_tinypage *prev;     // previous page of this class with free slots
+  struct el_tinypage *all_next; // next page in the chain of all tiny pages
+  struct el_tinypage *all_prev; // previous page in the chain of all tiny pages
+  int cls;                      // index of the tiny class
+  int slot_size;                // bytes in each slot
+  int nslots;                   // number of slots in the page
+  int nfree;                    // number of free slots
+  unsigned long bitmap[EL_TINY_BITMAP_WORDS]; // 1 bits mark free slots
+} el_tinypage_t;
+
+// Span tier: a region of whole pages carved from the list heap (see
+// el_mallopt()) and handed out in runs of contiguous pages called
+// spans. Medium requests and slab runs are served from it without
+// searching the list heap. Each page has a descriptor; the descriptor
+// of a span's first page describes the span. Free spans are kept in
+// bins by page count and coalesce with free neighbours. A page map
+// gives the span holding any page in O(1).
+#define EL_SPAN_BINS       16   // bins 1..14 hold that many pages, bin 15 anything larger
+#define EL_SPAN_MIN_SIZE   (EL_PAGE_SIZE / 2) // smallest request served from spans
+#define EL_SPAN_FREE       'f'  // span state indicating free
+#define EL_SPAN_USED       'u'  // span state indicating an allocation
+#define EL_SPAN_SLAB       's'  // span state indicating a slab run or tiny page
+
+// Type for the descriptor of a span, indexed by its first page.
+typedef struct {
+  int npages;                   // number of pages in the span
+  char state;                   // EL_SPAN_FREE, EL_SPAN_USED or EL_SPAN_SLAB
+  int next;                     // first page of next free span in same bin, -1 for none
+  int prev;                     // first page of previous free span in same bin, -1 for none
+} el_span_t;
+
+// Type for the span region.
+typedef struct {
+  void *pages;                  // first page of the region, NULL if there is none
+  size_t npages;                // number of pages in the region
+  el_span_t *spans;             // descriptor for each page
+  int *pagemap;                 // first page of the span holding each page
+  int bins[EL_SPAN_BINS];       // first page of the first free span in each bin, -1 for none
+} el_spanheap_t;
+
+// Radix map from page number to the metadata describing that page. Three
+// levels of EL_RADIX_BITS each cover the 36-bit page numbers of a 48-bit
+// address space; nodes are made as pages are registered. Each entry
+// holds a kind in its low bits and, for slab and tiny pages, the
+// address of the page's metadata in the rest. The map lets el_free() find the tier owning a
+// pointer without reading any memory near the pointer and el_owns()
+// tell the allocator's pointers from foreign ones.
+typedef uintptr_t el_pageent_t;
+#define EL_RADIX_BITS      12
+#define EL_RADIX_FANOUT    (1 << EL_RADIX_BITS)
+#define EL_PAGE_NONE       0    // page not managed by the allocator
+#define EL_PAGE_LIST       1    // page in the list heap; blocks carry inline headers
+#define EL_PAGE_SPAN       2    // page in the span region
+#define EL_PAGE_SLAB       3    // page holding a slab run
+#define EL_PAGE_TINY       4    // page of tiny objects; the rest of the entry is its el_tinypage_t
+#define EL_PAGE_KIND_MASK  ((el_pageent_t) 7)
+#define EL_PAGE_KIND(ent)  ((ent) & EL_PAGE_KIND_MASK)
+#define EL_PAGE_PTR(ent)   ((void *) ((ent) & ~EL_PAGE_KIND_MASK))
+
+// Parameters for el_mallopt()
+#define EL_OPT_SLAB        1    // enable/disable the slab tier
+#define EL_OPT_SPAN_PAGES  2    // size in pages of the span region
+#define EL_OPT_TINY        3    // enable/disable the tiny tier
+#define EL_OPT_SOFT_LIMIT  4    // bytes in use beyond which pressure callbacks run
+#define EL_OPT_HARD_LIMIT  5    // bytes in use beyond which allocations fail
+#define EL_OPT_REALTIME    6    // enable/disable bounded-latency mode
+#define EL_OPT_SLAB_TUNE   7    // slab requests between re-derivations of the slab classes
+#define EL_OPT_SHARDS      8    // split an empty heap into this many shards
+#define EL_OPT_DEFER_FREE  9    // milliseconds between maintenance passes, 0 to free at once
+#define EL_OPT_FREE_BUFFER 10   // frees each thread gathers before freeing them together, 0 for none
+
+#define EL_FREE_BUFFER_MAX 256  // largest value of EL_OPT_FREE_BUFFER
+
+// Type of a callback run when the bytes in use cross the soft limit;
+// it is passed the bytes in use and the argument it was registered with.
+typedef void (*el_pressure_fn)(size_t in_use, void *arg);
+
+#define EL_MAX_PRESSURE_CALLBACKS 8
+
+// Type for the byte budget of the heap set with el_mallopt(). Limits of
+// 0 are not enforced.
+typedef struct {
+  size_t soft_limit;            // bytes in use beyond which pressure callbacks run
+  size_t hard_limit;            // bytes in use beyond which allocations fail
+  size_t in_use;                // usable bytes of allocated blocks
+  size_t peak;                  // largest in_use seen
+  unsigned long soft_crossings; // times in_use rose past soft_limit
+  unsigned long hard_failures;  // allocations refused at hard_limit
+  int pressure_pending;         // 1 if callbacks are due once the lock is released
+  int ncallbacks;               // number of registered callbacks
+  el_pressure_fn callbacks[EL_MAX_PRESSURE_CALLBACKS];
+  void *callback_args[EL_MAX_PRESSURE_CALLBACKS];
+} el_budget_t;
+
+// Type of an out-of-memory handler; it is passed the size of the failed
+// request and the argument it was added with and returns non-zero if it
+// may have freed memory.
+typedef int (*el_oom_fn)(size_t nbytes, void *arg);
+
+#define EL_MAX_OOM_HANDLERS 8
+
+// Type for the chain of out-of-memory handlers run in order, retrying
+// the allocation after each, before el_malloc() returns NULL.
+typedef struct {
+  int nhandlers;                // number of handlers in the chain
+  el_oom_fn handlers[EL_MAX_OOM_HANDLERS];
+  void *handler_args[EL_MAX_OOM_HANDLERS];
+  unsigned long runs;           // allocations which ran the chain
+  unsigned long rescues;        // of those, ones a handler rescued
+} el_oomchain_t;
+
+// Type for a dense index of the sizes of the blocks in the available
+// list kept alongside the list by el_add_block_front() and
+// el_remove_block(). el_find_first_avail() scans the sizes array with
+// SIMD compares rather than following next links through every
+// block's header. Entries appear in reverse list order (the front of
+// the list is the last entry) so adding a block is an append.
+// Removing a block zeroes its entry, found through slot_of, and the
+// zeroed entries are compacted away once they make up half the index.
+typedef struct {
+  size_t *sizes;                // size of each indexed block, 0 if removed, NULL if there is no index
+  el_blockhead_t **blocks;      // block for each entry in sizes, NULL if removed
+  size_t *slot_of;              // entry of each indexed block, by its EL_INDEX_SLOT()
+  size_t count;                 // number of entries in use, removed ones included
+  size_t removed;               // number of removed entries below count
+  size_t capacity;              // number of entries the arrays can hold
+} el_sizeindex_t;
+
+// Real-time mode keeps the available blocks in two-level segregated
+// bins instead of the size index: the first level is the power of two
+// below a block's size and the second splits that range into
+// EL_RT_SL_COUNT. Bitmaps of the non-empty bins let el_find_first_avail()
+// find a block that fits in constant time.
+#define EL_RT_SL_BITS      4
+#define EL_RT_SL_COUNT     (1 << EL_RT_SL_BITS)
+#define EL_RT_FL_COUNT     64
+#define EL_RT_MIN_SIZE     ((size_t) EL_RT_SL_COUNT) // smallest binned block; holds two links
+
+typedef struct {
+  uint64_t fl_bitmap;           // bit f set if any bin in row f is non-empty
+  uint32_t sl_bitmap[EL_RT_FL_COUNT]; // bit s of row f set if bins[f][s] is non-empty
+  el_blockhead_t *bins[EL_RT_FL_COUNT][EL_RT_SL_COUNT]; // first block of each bin
+} el_rtbins_t;
+
+// Residency of the heap's pages as found by el_resident(), in bytes,
+// indexed by EL_RES_USED for pages holding part of a used block and
+// EL_RES_FREE for pages wholly inside available blocks or free spans.
+// Pages of slab runs and tiny pages count as used whatever their slots.
+#define EL_RES_USED 0
+#define EL_RES_FREE 1
+typedef struct {
+  size_t resident[2];           // in memory
+  size_t purged[2];             // released by el_trim() and not touched since
+  size_t untouched[2];          // never touched
+  size_t huge;                  // whole heap backed by transparent huge pages
+} el_residency_t;
+
+// Shards: with EL_OPT_SHARDS an empty private heap is split into equal
+// address ranges which are searched, split and merged independently.
+// Shard 0 is the lowest range and keeps el_ctl's lists and lock along
+// with the tiers, handles and everything else. Every other shard starts
+// with a fence block: a used block on no list whose payload holds the
+// shard's own lists, and which keeps blocks from merging across the
+// boundary. Each such shard has a lock of its own.
+#define EL_MAX_SHARDS      16
+
+// Type for the payload of a fence block
+typedef struct {
+  el_blocklist_t avail_actual;  // space for the shard's available list
+  el_blocklist_t used_actual;   // space for the shard's used list
+} el_fencelists_t;
+
+// Type for the state of one shard
+typedef struct {
+  el_blockhead_t *fence;        // fence at the start of the shard, NULL for shard 0
+  el_blocklist_t *avail;        // the shard's available list
+  el_blocklist_t *used;         // the shard's used list
+  pthread_mutex_t lock;         // guards the shard's lists; shard 0 uses el_ctl.lock
+  unsigned long mallocs;        // blocks allocated from the shard
+  unsigned long fallbacks;      // of those, blocks for threads preferring another shard
+} el_shard_t;
+
+// Deferred frees: with EL_OPT_DEFER_FREE el_free() only marks a list
+// block EL_PENDING and pushes it on a lock-free stack linked through
+// the blocks' payloads. A maintenance thread pops the whole stack every
+// interval, or sooner once EL_DEFER_BATCH blocks are waiting, frees
+// them with each shard's lock taken once and then trims the heap. An
+// allocation which fails frees the stack itself before giving up.
+#define EL_DEFER_BATCH     256
+
+// Type for the state of deferred frees
+typedef struct {
+  void *pending;                // stack of blocks waiting to be freed
+  unsigned long npending;       // blocks on the stack
+  long interval_ms;             // time between passes, 0 when frees are not deferred
+  int stop;                     // set to make the maintenance thread exit
+  pthread_t thread;             // the maintenance thread
+  unsigned long deferred;       // blocks pushed on the stack
+  unsigned long drained;        // blocks freed from the stack
+  unsigned long passes;         // passes of the maintenance thread
+  unsigned long forced;         // stacks freed by failing allocations
+  unsigned long pushing;        // el_defer_push() calls under way
+} el_defer_t;
+
+// Type for the metadata kept in the page(s) immediately after
+// heap_end in a file-backed or shared heap. The block lists and lock
+// live here rather than in el_ctl so that every pointer in the heap
+// refers to memory inside the mapping; as the mapping is always at
+// EL_HEAP_START_ADDRESS the lists remain valid across restarts and in
+// every process sharing the heap.
+typedef struct {
+  unsigned long magic;          // EL_HEAP_MAGIC once the heap is formatted
+  size_t heap_bytes;            // size of the heap area preceding this metadata
+  int clean;                    // 1 if closed by el_cleanup(), 0 while in use
+  el_blocklist_t avail_actual;  // space for the available list data
+  el_blocklist_t used_actual;   // space for the used list data
+  pthread_mutex_t lock;         // process-shared robust lock guarding the lists
+} el_heapmeta_t;
+
+// Number of bytes reserved after the heap for an el_heapmeta_t; a
+// whole number of pages
+#define EL_HEAP_META_BYTES \
+  (((sizeof(el_heapmeta_t) + EL_PAGE_SIZE - 1) / EL_PAGE_SIZE) * EL_PAGE_SIZE)
+
 // Type for the global control structure of the allocator. Tracks heap size,
 // start and end addresses, total size, and lists of available and
 // used blocks.
@@ -73,13 +402,108 @@ typedef struct {
   el_blocklist_t used_actual;   // space for the used list data
   el_blocklist_t *avail;        // pointer to avail_actual
   el_blocklist_t *used;         // pointer to used_actual
+  el_heapmeta_t *meta;          // metadata after heap_end for file-backed/shared heaps, NULL otherwise
+  int heap_fd;                  // open file descriptor for a file-backed/shared heap
+  int heap_shared;              // 1 if the heap is shared with other processes
+  pthread_mutex_t lock_actual;  // space for the lock of a private heap
+  pthread_mutex_t *lock;        // lock_actual or the lock in meta
+  el_handleent_t handles[EL_MAX_HANDLES]; // handle table for el_halloc(); private to this process
+  el_sizeindex_t avail_index;   // size index for the available list of a private heap
+  int slab_enabled;             // 1 if small requests are served from slab runs
+  size_t slab_runs;             // number of live slab runs
+  el_slabrun_t *slab_partial[EL_SLAB_CLASSES]; // runs with free slots for each class
+  el_slabrun_t *slab_empty[EL_SLAB_CLASSES]; // entirely free run kept for each class, if any
+  el_spanheap_t spans;          // span region, if any
+  el_slabrun_t *slab_all;       // chain of all live slab runs
+  size_t slab_sizes[EL_SLAB_CLASSES]; // slot size of each slab class, smallest first
+  unsigned char slab_class_of[EL_SLAB_MAX_SIZE + 1]; // class serving each request size
+  unsigned long slab_hist[EL_SLAB_MAX_SIZE + 1]; // slab requests seen of each size, decayed
+  unsigned long slab_tune_period; // slab requests between re-derivations, 0 for never
+  unsigned long slab_tune_count; // slab requests since the last re-derivation
+  unsigned long slab_retunes;   // times the slab classes have changed
+  void *radix;                  // root node of the page radix map
+  int tiny_enabled;             // 1 if the smallest requests are served from tiny pages
+  el_tinypage_t *tiny_partial[EL_TINY_CLASSES]; // tiny pages with free slots for each class
+  el_tinypage_t *tiny_all;      // chain of all tiny pages
+  el_tinypage_t *tiny_empty[EL_TINY_CLASSES]; // entirely free page kept for each class, if any
+  unsigned long epoch;          // bumped by el_cleanup() so object caches can spot a dead heap
+  el_budget_t budget;           // byte budget and its counters
+  el_oomchain_t oom;            // handlers run when an allocation fails
+  int rt_enabled;               // 1 in bounded-latency mode, see EL_OPT_REALTIME
+  el_rtbins_t rt_bins;          // bins of available blocks in bounded-latency mode
+  unsigned long *purged;        // bit per heap page released by el_trim(), NULL until the first
+  int nshards;                  // number of shards, 0 if the heap is not split
+  size_t shard_bytes;           // bytes of each shard
+  el_shard_t shards[EL_MAX_SHARDS]; // state of each shard
+  el_defer_t defer;             // frees waiting for the maintenance thread
+  int free_buffer;              // frees buffered per thread, see EL_OPT_FREE_BUFFER
 } el_ctl_t;
 
 // Main instance of el_ctl_t defined in el_malloc.c
 extern el_ctl_t el_ctl;
 
+// Accessors for the list links of a block and the end node links of a
+// list which hide whether links are pointers or offsets
+// (EL_OFFSET_LINKS) from heap_start.
+#ifdef EL_OFFSET_LINKS
+static inline el_blockhead_t *el_link_to_block(uint32_t link) {
+  return link == EL_NULL_LINK ? NULL : (el_blockhead_t *) PTR_PLUS_BYTES(el_ctl.heap_start, link);
+}
+static inline uint32_t el_block_to_link(el_blockhead_t *block) {
+  return block == NULL ? EL_NULL_LINK : (uint32_t) PTR_MINUS_PTR(block, el_ctl.heap_start);
+}
+static inline el_blockhead_t *el_block_next(el_blockhead_t *block) {
+  return el_link_to_block(block->next);
+}
+static inline el_blockhead_t *el_block_prev(el_blockhead_t *block) {
+  return el_link_to_block(block->prev);
+}
+static inline void el_block_set_next(el_blockhead_t *block, el_blockhead_t *next) {
+  block->next = el_block_to_link(next);
+}
+static inline void el_block_set_prev(el_blockhead_t *block, el_blockhead_t *prev) {
+  block->prev = el_block_to_link(prev);
+}
+static inline el_blockhead_t *el_list_beg(el_blocklist_t *list) {
+  return el_link_to_block(list->beg);
+}
+static inline el_blockhead_t *el_list_end(el_blocklist_t *list) {
+  return el_link_to_block(list->end);
+}
+static inline void el_list_set_ends(el_blocklist_t *list) {
+  list->beg = el_block_to_link(&list->beg_actual);
+  list->end = el_block_to_link(&list->end_actual);
+}
+#else
+static inline el_blockhead_t *el_block_next(el_blockhead_t *block) {
+  return block->next;
+}
+static inline el_blockhead_t *el_block_prev(el_blockhead_t *block) {
+  return block->prev;
+}
+static inline void el_block_set_next(el_blockhead_t *block, el_blockhead_t *next) {
+  block->next = next;
+}
+static inline void el_block_set_prev(el_blockhead_t *block, el_blockhead_t *prev) {
+  block->prev = prev;
+}
+static inline el_blockhead_t *el_list_beg(el_blocklist_t *list) {
+  return list->beg;
+}
+static inline el_blockhead_t *el_list_end(el_blocklist_t *list) {
+  return list->end;
+}
+static inline void el_list_set_ends(el_blocklist_t *list) {
+  list->beg = &list->beg_actual;
+  list->end = &list->end_actual;
+}
+#endif
+
 // functions defined in el_malloc.c
 int el_init();
+int el_init_size(size_t heap_bytes);
+int el_init_file(const char *path, size_t heap_bytes);
+int el_init_shared(const char *name, size_t heap_bytes);
 void el_print_stats();
 void el_cleanup();
 
@@ -100,5 +524,40 @@ void *el_malloc(size_t nbytes);
 
 void el_merge_block_with_above(el_blockhead_t *lower);
 void el_free(void *ptr);
+void el_free_sized(void *ptr, size_t nbytes);
+void *el_memalign(size_t align, size_t nbytes);
+void *el_realloc(void *ptr, size_t nbytes);
+size_t el_malloc_usable_size(void *ptr);
+size_t el_good_size(size_t nbytes);
+int el_malloc_batch(size_t align, size_t nbytes, void **ptrs, int count);
+void el_free_batch(void **ptrs, int count);
+int el_free_flush();
+int el_mallopt(int param, long value);
+int el_add_pressure_callback(el_pressure_fn fn, void *arg);
+void el_print_budget();
+int el_add_oom_handler(el_oom_fn fn, void *arg);
+int el_oom_purge(size_t nbytes, void *arg);
+int el_oom_compact(size_t nbytes, void *arg);
+void el_print_spans();
+void el_print_slab_classes();
+void el_print_shards();
+void el_print_defer();
+int el_owns(void *ptr);
+
+el_handle_t el_halloc(size_t nbytes);
+void *el_hpin(el_handle_t handle);
+void el_hunpin(el_handle_t handle);
+void el_hfree(el_handle_t handle);
+size_t el_compact(size_t max_moves);
+size_t el_trim();
+int el_resident(el_residency_t *res);
+void el_print_resident();
+
+int el_snapshot(const char *path);
+int el_restore(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // EL_MALLOC_H
@@ -0,0 +1,229 @@
+#ifndef EL_MALLOC_HPP
+#define EL_MALLOC_HPP
+
+// C++ adapters which put standard containers on the el_malloc heap:
+//
+//   std::vector<int, el::allocator<int>> v;       // allocator-aware containers
+//   el::memory_resource res;                      // std::pmr containers
+//   std::pmr::vector<int> w(&res);
+//   el::fixed_for<Node>::allocate();              // fixed-size objects
+//
+// The heap must be set up with el_init() or one of its variants before
+// either is used. A process has a single el_malloc heap so every
+// allocator and resource refers to the same one and they all compare
+// equal; memory from one may be freed by any other.
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+
+#include "el_malloc.h"
+
+namespace el {
+
+// Allocate nbytes aligned to align from the heap, throwing
+// std::bad_alloc if no space is available. el_malloc() does not round
+// list block sizes so its pointers carry no alignment; el_memalign()
+// serves aligned requests from the tiers when they are enabled.
+inline void *allocate_bytes(std::size_t nbytes, std::size_t align) {
+  void *ptr = el_memalign(align, nbytes);
+  if(ptr == NULL) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+// Standard allocator usable with std::vector, std::map and friends.
+template <typename T>
+struct allocator {
+  typedef T value_type;
+
+  allocator() noexcept {}
+  template <typename U>
+  allocator(const allocator<U> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    if(n > std::size_t(-1) / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+    return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, std::size_t) noexcept {
+    el_free(ptr);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+  return false;
+}
+
+// Polymorphic memory resource for std::pmr containers. Deallocation is
+// given the size and alignment of the original request but el_free()
+// finds the block's tier from the radix map so neither is needed.
+class memory_resource : public std::pmr::memory_resource {
+protected:
+  void *do_allocate(std::size_t nbytes, std::size_t align) override {
+    return allocate_bytes(nbytes, align);
+  }
+
+  void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+    el_free(ptr);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return dynamic_cast<const memory_resource *>(&other) != nullptr;
+  }
+};
+
+namespace detail {
+
+// release() of each fixed_alloc the calling thread has used
+struct thread_caches {
+  int (*release[64])();
+  int count;
+};
+inline thread_local thread_caches caches_used = {};
+
+} // namespace detail
+
+// Give back the cached objects of every fixed_alloc the calling thread
+// has used, returning non-zero if there were any. Its signature lets it
+// be added to the out-of-memory chain with el_add_oom_handler(); other
+// threads' caches are out of its reach.
+inline int release_thread_caches(std::size_t = 0, void * = nullptr) {
+  int released = 0;
+  for(int i = 0; i < detail::caches_used.count; i++) {
+    released += detail::caches_used.release[i]();
+  }
+  return released > 0;
+}
+
+// Allocator for objects of one size known at compile time. The size
+// class is fixed by the template arguments so allocate() and
+// deallocate() inline to a pop or push on a thread-local free list;
+// the heap is only called, one batch per lock, to refill an empty list
+// or to trim one that has grown past twice the batch size. Objects may
+// be freed by any thread or with el_free(). A thread's list goes back
+// to the heap when the thread exits; a list left from before
+// el_cleanup() is dropped the next time the thread uses it, as its
+// objects went with the old heap. release_thread_caches() empties
+// every list of the calling thread.
+template <std::size_t Size, std::size_t Align = alignof(std::max_align_t)>
+class fixed_alloc {
+  static_assert(Align != 0 && (Align & (Align - 1)) == 0, "alignment must be a power of two");
+
+public:
+  // free objects hold the list link so must fit and align a pointer
+  static constexpr std::size_t align = Align < alignof(void *) ? alignof(void *) : Align;
+  static constexpr std::size_t size =
+    ((Size < sizeof(void *) ? sizeof(void *) : Size) + align - 1) & ~(align - 1);
+  static constexpr int batch = size <= 256 ? 64 : size <= 4096 ? 16 : 4;
+
+  static void *allocate() {
+    cache &c = local;
+    void *ptr = c.head;
+    if(__builtin_expect(ptr == nullptr || c.epoch != el_ctl.epoch, 0)) {
+      return refill(c);
+    }
+    c.head = *static_cast<void **>(ptr);
+    c.count--;
+    return ptr;
+  }
+
+  static void deallocate(void *ptr) noexcept {
+    cache &c = local;
+    if(__builtin_expect(c.epoch != el_ctl.epoch, 0)) {
+      drop(c);
+    }
+    *static_cast<void **>(ptr) = c.head;
+    c.head = ptr;
+    if(__builtin_expect(++c.count > 2 * batch, 0)) {
+      flush(c, batch);
+    }
+  }
+
+  // Give all of this thread's cached objects back to the heap,
+  // returning how many there were.
+  static int release() noexcept {
+    int count = local.count;
+    flush(local, 0);
+    return count;
+  }
+
+private:
+  struct cache {
+    void *head = nullptr;
+    int count = 0;
+    unsigned long epoch = 0;              // el_ctl.epoch of the heap the objects came from
+    cache() {
+      detail::thread_caches &used = detail::caches_used;
+      if(used.count < 64) {
+        used.release[used.count++] = release;
+      }
+    }
+    ~cache() { flush(*this, 0); }
+  };
+  static thread_local cache local;
+
+  static __attribute__((noinline)) void *refill(cache &c) {
+    void *ptrs[batch];
+    int got = el_malloc_batch(align, size, ptrs, batch);
+    if(got == 0) {
+      throw std::bad_alloc();
+    }
+    if(c.epoch != el_ctl.epoch) {
+      drop(c);
+    }
+    for(int i = 1; i < got; i++) {
+      *static_cast<void **>(ptrs[i]) = c.head;
+      c.head = ptrs[i];
+    }
+    c.count += got - 1;
+    return ptrs[0];
+  }
+
+  // Forget the objects on a list left from a heap which has since been
+  // torn down and start an empty one for the current heap.
+  static __attribute__((noinline)) void drop(cache &c) noexcept {
+    c.head = nullptr;
+    c.count = 0;
+    c.epoch = el_ctl.epoch;
+  }
+
+  // Free objects from the list until keep remain. If the heap has been
+  // torn down since the list was filled its objects are simply dropped.
+  static __attribute__((noinline)) void flush(cache &c, int keep) noexcept {
+    if(c.epoch != el_ctl.epoch) {
+      drop(c);
+      return;
+    }
+    void *ptrs[batch];
+    while(c.count > keep) {
+      int n = 0;
+      while(n < batch && c.count > keep) {
+        ptrs[n++] = c.head;
+        c.head = *static_cast<void **>(c.head);
+        c.count--;
+      }
+      el_free_batch(ptrs, n);
+    }
+  }
+};
+
+template <std::size_t Size, std::size_t Align>
+thread_local typename fixed_alloc<Size, Align>::cache fixed_alloc<Size, Align>::local;
+
+// fixed_alloc sized and aligned for objects of type T
+template <typename T>
+using fixed_for = fixed_alloc<sizeof(T), alignof(T)>;
+
+} // namespace el
+
+#endif // EL_MALLOC_HPP
@@ -0,0 +1,166 @@
+// Replacement global operator new/delete which put every C++
+// allocation of a program on the el_malloc heap. Link el_new.o into a
+// program to use it. The heap is set up on the first allocation,
+// usually during static initialisation, unless the program has already
+// called el_init() or a variant; in that case tiers are left as the
+// program configured them.
+//
+// Plain new returns blocks aligned to __STDCPP_DEFAULT_NEW_ALIGNMENT__
+// and the std::align_val_t forms use the requested alignment, both via
+// el_memalign(). Sized deletes go to el_free_sized().
+
+#include <cstddef>
+#include <new>
+#include <pthread.h>
+
+#include "el_malloc.h"
+
+#define EL_NEW_HEAP_BYTES (1L << 30)    // heap set up by the first new
+#define EL_NEW_SPAN_PAGES 32768         // 128 MiB of it for medium requests
+
+static pthread_mutex_t el_new_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t el_new_fork_once = PTHREAD_ONCE_INIT;
+
+// Like the heap lock, the set-up lock is held across fork() so that a
+// child never inherits it mid set-up. The heap's own handlers are
+// installed by el_init_size() and these only after them: fork runs
+// prepare handlers in reverse order, so it then takes the set-up lock
+// before the heap lock, the same order as el_new_init().
+static void el_new_fork_prepare() {
+  pthread_mutex_lock(&el_new_init_lock);
+}
+
+static void el_new_fork_parent() {
+  pthread_mutex_unlock(&el_new_init_lock);
+}
+
+static void el_new_fork_child() {
+  pthread_mutex_init(&el_new_init_lock, NULL);
+}
+
+static void el_new_watch_fork() {
+  pthread_atfork(el_new_fork_prepare, el_new_fork_parent, el_new_fork_child);
+}
+
+// Set up the heap with the tiny and slab tiers and a span region if
+// nothing has set it up yet. Threads racing on the first allocation
+// wait for the winner.
+static void el_new_init() {
+  pthread_mutex_lock(&el_new_init_lock);
+  if(el_ctl.heap_start == NULL && el_init_size(EL_NEW_HEAP_BYTES) == 0) {
+    el_mallopt(EL_OPT_TINY, 1);
+    el_mallopt(EL_OPT_SLAB, 1);
+    el_mallopt(EL_OPT_SPAN_PAGES, EL_NEW_SPAN_PAGES);
+  }
+  pthread_once(&el_new_fork_once, el_new_watch_fork);
+  pthread_mutex_unlock(&el_new_init_lock);
+}
+
+// Allocate as operator new does, returning NULL rather than throwing if
+// no space can be found after running any new_handler.
+static void *el_new_alloc(std::size_t nbytes, std::size_t align, bool nothrow) {
+  if(__builtin_expect(el_ctl.heap_start == NULL, 0)) {
+    el_new_init();
+  }
+  if(nbytes == 0) {
+    nbytes = 1;                         // distinct pointers for empty objects
+  }
+  for(;;) {
+    void *ptr = el_memalign(align, nbytes);
+    if(ptr != NULL) {
+      return ptr;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if(handler == NULL) {
+      if(nothrow) {
+        return NULL;
+      }
+      throw std::bad_alloc();
+    }
+    try {
+      handler();
+    }
+    catch(const std::bad_alloc &) {
+      if(nothrow) {
+        return NULL;
+      }
+      throw;
+    }
+  }
+}
+
+static void el_new_free(void *ptr) noexcept {
+  if(ptr != NULL) {
+    el_free(ptr);
+  }
+}
+
+static void el_new_free_sized(void *ptr, std::size_t nbytes) noexcept {
+  if(ptr != NULL) {
+    el_free_sized(ptr, nbytes == 0 ? 1 : nbytes);
+  }
+}
+
+#define EL_NEW_ALIGN __STDCPP_DEFAULT_NEW_ALIGNMENT__
+
+void *operator new(std::size_t n) {
+  return el_new_alloc(n, EL_NEW_ALIGN, false);
+}
+void *operator new[](std::size_t n) {
+  return el_new_alloc(n, EL_NEW_ALIGN, false);
+}
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept {
+  return el_new_alloc(n, EL_NEW_ALIGN, true);
+}
+void *operator new[](std::size_t n, const std::nothrow_t &) noexcept {
+  return el_new_alloc(n, EL_NEW_ALIGN, true);
+}
+void *operator new(std::size_t n, std::align_val_t al) {
+  return el_new_alloc(n, static_cast<std::size_t>(al), false);
+}
+void *operator new[](std::size_t n, std::align_val_t al) {
+  return el_new_alloc(n, static_cast<std::size_t>(al), false);
+}
+void *operator new(std::size_t n, std::align_val_t al, const std::nothrow_t &) noexcept {
+  return el_new_alloc(n, static_cast<std::size_t>(al), true);
+}
+void *operator new[](std::size_t n, std::align_val_t al, const std::nothrow_t &) noexcept {
+  return el_new_alloc(n, static_cast<std::size_t>(al), true);
+}
+
+void operator delete(void *p) noexcept {
+  el_new_free(p);
+}
+void operator delete[](void *p) noexcept {
+  el_new_free(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  el_new_free(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  el_new_free(p);
+}
+void operator delete(void *p, std::size_t n) noexcept {
+  el_new_free_sized(p, n);
+}
+void operator delete[](void *p, std::size_t n) noexcept {
+  el_new_free_sized(p, n);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+  el_new_free(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+  el_new_free(p);
+}
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  el_new_free(p);
+}
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  el_new_free(p);
+}
+void operator delete(void *p, std::size_t n, std::align_val_t) noexcept {
+  el_new_free_sized(p, n);
+}
+void operator delete[](void *p, std::size_t n, std::align_val_t) noexcept {
+  el_new_free_sized(p, n);
+}
@@ -0,0 +1,265 @@
+// Derive slab size classes from recorded allocation sizes and write
+// them as a header el_malloc can be compiled with:
+//
+//   el_size_classes -k 8 -o svc_classes.h svc.trace
+//   make clean && make SLAB_CONFIG=svc_classes.h
+//
+// Input lines are either a histogram bucket "<size> [<count>]" or a
+// trace record "malloc <size>", "calloc <n> <size>" or
+// "realloc <ptr> <size>"; other records such as "free <ptr>", blank
+// lines and lines starting with # are skipped. Several files may be
+// given; with none standard input is read.
+//
+// A request of s bytes served by a class of c-byte slots costs the
+// run bytes per slot, EL_SLAB_RUN_BYTES / slots in a run, less s: the
+// slack in the slot plus its share of the run header and of the tail
+// no slot fits in. A request above the largest class goes to a list
+// block and costs EL_BLOCK_OVERHEAD. Dynamic programming over slot
+// sizes which are multiples of the granularity picks the given number
+// of classes, and so EL_SLAB_MAX_SIZE, with the least total cost.
+// Requests above the size limit are left out as no slab class could
+// serve them.
+//
+// usage: el_size_classes [-k classes] [-g granularity] [-m limit] [-o out.h] [file...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "el_malloc.h"
+
+#define DEFAULT_CLASSES  EL_SLAB_CLASSES
+#define DEFAULT_GRAIN    16             // keeps slots 16-byte aligned
+#define DEFAULT_LIMIT    1024           // largest slot considered
+#define RUN_HEADER_BYTES ((sizeof(el_slabrun_t) + 15) & ~15UL)
+#define MAX_SLOT_BYTES   (EL_SLAB_RUN_BYTES - RUN_HEADER_BYTES)
+
+static double *count;                   // requests of each size up to the limit
+static size_t limit = DEFAULT_LIMIT;
+static double skipped;                  // requests above the limit
+
+// Run bytes spent on each slot of a class of slot bytes.
+static double footprint(size_t slot) {
+    return (double) EL_SLAB_RUN_BYTES / ((EL_SLAB_RUN_BYTES - RUN_HEADER_BYTES) / slot);
+}
+
+// Count the requests recorded in one line of input.
+static void add_line(char *line) {
+    char *tok[3];
+    int ntok = 0;
+    for (char *t = strtok(line, " \t\r\n,"); t != NULL && ntok < 3; t = strtok(NULL, " \t\r\n,")) {
+        tok[ntok++] = t;
+    }
+    if (ntok == 0 || tok[0][0] == '#') {
+        return;
+    }
+
+    double n = 1;
+    long size;
+    if (strcmp(tok[0], "malloc") == 0 && ntok >= 2) {
+        size = atol(tok[1]);
+    }
+    else if (strcmp(tok[0], "calloc") == 0 && ntok >= 3) {
+        size = atol(tok[1]) * atol(tok[2]);
+    }
+    else if (strcmp(tok[0], "realloc") == 0 && ntok >= 3) {
+        size = atol(tok[2]);
+    }
+    else if (tok[0][0] >= '0' && tok[0][0] <= '9') {
+        size = atol(tok[0]);
+        n = ntok >= 2 ? atof(tok[1]) : 1;
+    }
+    else {
+        return;
+    }
+
+    if (size <= 0) {
+        return;
+    }
+    if ((size_t) size > limit) {
+        skipped += n;
+    }
+    else {
+        count[size] += n;
+    }
+}
+
+static void read_input(FILE *in) {
+    char line[512];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        add_line(line);
+    }
+}
+
+// Total cost of serving the recorded requests with the given classes,
+// smallest first.
+static double table_cost(const size_t *sizes, int nclasses) {
+    double cost = 0;
+    int cls = 0;
+    for (size_t s = 1; s <= limit; s++) {
+        while (cls < nclasses && sizes[cls] < s) {
+            cls++;
+        }
+        cost += count[s] * (cls < nclasses ? footprint(sizes[cls]) - s : EL_BLOCK_OVERHEAD);
+    }
+    return cost;
+}
+
+// Choose nclasses slot sizes among multiples of grain up to the limit
+// minimizing table_cost(); returns 0 on success and -1 if there are
+// fewer candidate sizes than classes.
+static int optimize(size_t *sizes, int nclasses, size_t grain) {
+    int ncand = limit / grain;
+    if (ncand < nclasses) {
+        return -1;
+    }
+
+    // prefix sums of requests (cnt) and requested bytes (bytes) over
+    // sizes up to each candidate; candidate j is (j + 1) * grain bytes
+    // and index -1 stands for 0 bytes
+    double *cnt = calloc(ncand + 1, sizeof(double));
+    double *bytes = calloc(ncand + 1, sizeof(double));
+    for (int j = 0; j < ncand; j++) {
+        cnt[j + 1] = cnt[j];
+        bytes[j + 1] = bytes[j];
+        for (size_t s = j * grain + 1; s <= (j + 1) * grain; s++) {
+            cnt[j + 1] += count[s];
+            bytes[j + 1] += count[s] * s;
+        }
+    }
+
+    // best[k * ncand + j]: least cost of the requests up to candidate j
+    // served by k + 1 classes the largest of which is candidate j;
+    // from[] holds the candidate of the class below
+    double *best = malloc(sizeof(double) * nclasses * ncand);
+    int *from = malloc(sizeof(int) * nclasses * ncand);
+    for (int j = 0; j < ncand; j++) {
+        best[j] = cnt[j + 1] * footprint((j + 1) * grain) - bytes[j + 1];
+        from[j] = -1;
+    }
+    for (int k = 1; k < nclasses; k++) {
+        for (int j = k; j < ncand; j++) {
+            double f = footprint((j + 1) * grain);
+            best[k * ncand + j] = -1;
+            for (int i = k - 1; i < j; i++) {
+                double c = best[(k - 1) * ncand + i] +
+                    (cnt[j + 1] - cnt[i + 1]) * f - (bytes[j + 1] - bytes[i + 1]);
+                if (best[k * ncand + j] < 0 || c < best[k * ncand + j]) {
+                    best[k * ncand + j] = c;
+                    from[k * ncand + j] = i;
+                }
+            }
+        }
+    }
+
+    // requests above the largest class go to list blocks
+    int top = nclasses - 1;
+    double least = -1;
+    for (int j = top; j < ncand; j++) {
+        double c = best[top * ncand + j] + (cnt[ncand] - cnt[j + 1]) * EL_BLOCK_OVERHEAD;
+        if (least < 0 || c < least) {
+            least = c;
+            sizes[top] = j;
+        }
+    }
+    for (int k = top; k > 0; k--) {
+        sizes[k - 1] = from[k * ncand + sizes[k]];
+    }
+    for (int k = 0; k < nclasses; k++) {
+        sizes[k] = (sizes[k] + 1) * grain;
+    }
+
+    free(cnt);
+    free(bytes);
+    free(best);
+    free(from);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-k classes] [-g granularity] [-m limit] [-o out.h] [file...]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int nclasses = DEFAULT_CLASSES;
+    size_t grain = DEFAULT_GRAIN;
+    const char *out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:g:m:o:")) != -1) {
+        switch (opt) {
+        case 'k': nclasses = atoi(optarg); break;
+        case 'g': grain = atol(optarg); break;
+        case 'm': limit = atol(optarg); break;
+        case 'o': out_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    // slots must hold a bitmap bit each and fit a run, and class
+    // indices are kept in bytes
+    if (nclasses < 1 || nclasses > 255 || grain < 8 || grain % 8 != 0 ||
+        limit < grain || limit > MAX_SLOT_BYTES) {
+        fprintf(stderr, "need 1 <= classes <= 255, granularity a multiple of 8, "
+                "granularity <= limit <= %lu\n", MAX_SLOT_BYTES);
+        return 1;
+    }
+
+    count = calloc(limit + 1, sizeof(double));
+    if (optind == argc) {
+        read_input(stdin);
+    }
+    for (int i = optind; i < argc; i++) {
+        FILE *in = fopen(argv[i], "r");
+        if (in == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        read_input(in);
+        fclose(in);
+    }
+
+    double total = 0, bytes = 0;
+    for (size_t s = 1; s <= limit; s++) {
+        total += count[s];
+        bytes += count[s] * s;
+    }
+    if (total == 0) {
+        fprintf(stderr, "no requests of %lu bytes or less in the input\n", limit);
+        return 1;
+    }
+
+    size_t *sizes = malloc(sizeof(size_t) * nclasses);
+    if (optimize(sizes, nclasses, grain) != 0) {
+        fprintf(stderr, "fewer than %d multiples of %lu up to %lu\n", nclasses, grain, limit);
+        return 1;
+    }
+    const size_t defaults[] = EL_SLAB_SIZES;
+    double before = table_cost(defaults, EL_SLAB_CLASSES);
+    double after = table_cost(sizes, nclasses);
+
+    FILE *out = stdout;
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(out, "// Slab size classes written by el_size_classes; compile el_malloc\n");
+    fprintf(out, "// with -DEL_SLAB_CONFIG='\"%s\"' to use them.\n", out_path != NULL ? out_path : "this_file.h");
+    fprintf(out, "//\n");
+    fprintf(out, "// requests:          %.0f of %.0f bytes, %.0f above %lu bytes left out\n",
+            total, bytes, skipped, limit);
+    fprintf(out, "// overhead, built-in: %.0f bytes (%.1f%%)\n", before, 100 * before / bytes);
+    fprintf(out, "// overhead, these:    %.0f bytes (%.1f%%)\n", after, 100 * after / bytes);
+    fprintf(out, "#define EL_SLAB_SIZES      {");
+    for (int k = 0; k < nclasses; k++) {
+        fprintf(out, "%s%lu", k == 0 ? "" : ", ", sizes[k]);
+    }
+    fprintf(out, "}\n");
+    fprintf(out, "#define EL_SLAB_CLASSES    %d\n", nclasses);
+    fprintf(out, "#define EL_SLAB_MAX_SIZE   %lu\n", sizes[nclasses - 1]);
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(sizes);
+    free(count);
+    return 0;
+}
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "el_malloc.h"
 
 #define HEAP_SIZE 1024
@@ -26,6 +29,40 @@ void print_ptrs(void *ptr[], int len) {
     }
 }
 
+// pressure callback for the budget test which frees the block in arg
+void shed_cache(size_t in_use, void *arg) {
+    void **cache = arg;
+    printf("PRESSURE at %lu bytes, shedding cache\n", in_use);
+    if (*cache != NULL) {
+        el_free(*cache);
+        *cache = NULL;
+    }
+}
+
+// out-of-memory handler for the handler chain test which frees nothing
+int log_oom(size_t nbytes, void *arg) {
+    printf("OOM handler '%s' for %lu bytes\n", (char *) arg, nbytes);
+    return 0;
+}
+
+// thread for the fork test which allocates and frees until told to stop
+volatile int churn_stop;
+void *churn(void *arg) {
+    while (!churn_stop) {
+        void *p = el_malloc(64);
+        void *q = el_malloc(200);
+        el_free(p);
+        el_free(q);
+    }
+    return NULL;
+}
+
+// thread for the shard test which allocates one block into arg
+void *shard_thread(void *arg) {
+    *(void **) arg = el_malloc(500);
+    return NULL;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         printf("Usage: %s <test_name>\n", argv[0]);
@@ -97,7 +134,7 @@ int main(int argc, char *argv[]) {
         ptr[len++] = el_malloc(200);
         ptr[len++] = el_malloc(64);
 
-        el_blockhead_t *head = el_ctl.used->beg->next;
+        el_blockhead_t *head = el_block_next(el_list_beg(el_ctl.used));
         el_blockfoot_t *foot;
 
         foot = el_get_footer(head);
@@ -509,6 +546,715 @@ int main(int argc, char *argv[]) {
         print_ptrs(ptr, len);
     } // ENDTEST
 
+    else if (strcmp(test_name, "File Heap Reopen") == 0) {
+        PRINT_TEST;
+        // Creates a file-backed heap, allocates and fills a block, then
+        // closes it cleanly and reopens it. The lists and data should be
+        // unchanged. A child process then allocates and exits without
+        // el_cleanup(); reopening must rebuild the lists from the
+        // boundary tags. Failing to attach a file which is not a heap
+        // must leave the private heap in use as it was.
+
+        el_cleanup();
+        unlink("test-heap.dat");
+        el_init_file("test-heap.dat", 4096);
+        char *p0 = el_malloc(128);
+        strcpy(p0, "persistent data");
+        char *p1 = el_malloc(200);
+        el_free(p1);
+        printf("BEFORE CLOSE\n");
+        el_print_stats();
+        el_cleanup();
+
+        el_init_file("test-heap.dat", 0);
+        printf("\nAFTER REOPEN\n");
+        el_print_stats();
+        printf("p0 contents: %s\n", p0);
+
+        if (fork() == 0) {
+            el_malloc(64);
+            el_free(p0);
+            _exit(0);           // no el_cleanup(): heap left unclean
+        }
+        wait(NULL);
+        el_cleanup();           // closes this process's (stale) view
+        int fd = open("test-heap.dat", O_RDWR);
+        el_heapmeta_t meta;
+        pread(fd, &meta, sizeof(meta), 4096);
+        meta.clean = 0;         // simulate the crash having hit the file
+        pwrite(fd, &meta, sizeof(meta), 4096);
+        close(fd);
+
+        el_init_file("test-heap.dat", 0);
+        printf("\nAFTER CRASH RECOVERY\n");
+        el_print_stats();
+        el_cleanup();
+        unlink("test-heap.dat");
+
+        el_init(HEAP_SIZE);
+        void *p2 = el_malloc(100);
+        fd = open("test-heap.dat", O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ftruncate(fd, 2 * 4096);            // zero filled: no heap magic
+        close(fd);
+        printf("\nATTACH NOT A HEAP: %d\n", el_init_file("test-heap.dat", 0));
+        el_free(p2);
+        p2 = el_malloc(200);
+        printf("PRIVATE HEAP STILL IN USE\n");
+        el_print_stats();
+        unlink("test-heap.dat");
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Shared Heap") == 0) {
+        PRINT_TEST;
+        // Creates an anonymous shared heap then forks. The child
+        // allocates and fills a block which the parent should see in both
+        // the lists and the data. A second child dies while holding the
+        // heap lock; the parent's next allocation must recover the lock.
+
+        el_cleanup();
+        el_init_shared(NULL, 4096);
+        char *p0 = el_malloc(128);
+        if (fork() == 0) {
+            char *p1 = el_malloc(64);
+            strcpy(p1, "written by child");
+            el_free(p0);
+            _exit(0);
+        }
+        wait(NULL);
+        printf("AFTER CHILD\n");
+        el_print_stats();
+        el_blockhead_t *head = el_block_next(el_list_beg(el_ctl.used));
+        printf("child data: %s\n", (char *) PTR_PLUS_BYTES(head, sizeof(el_blockhead_t)));
+
+        if (fork() == 0) {
+            pthread_mutex_lock(el_ctl.lock);
+            _exit(0);           // dies holding the lock
+        }
+        wait(NULL);
+        p0 = el_malloc(200);
+        printf("\nAFTER LOCK OWNER DIED\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Handle Compaction") == 0) {
+        PRINT_TEST;
+        // Allocates several handle blocks around an ordinary block and
+        // frees some to leave holes. Compaction should slide unpinned
+        // handle blocks down into the holes while leaving the pinned
+        // handle and the ordinary block in place, preserving contents.
+        // Handles not in use are refused, and a fresh heap after
+        // el_cleanup() starts with every handle free.
+
+        el_handle_t h0 = el_halloc(100);
+        el_handle_t h1 = el_halloc(200);
+        void *p2 = el_malloc(64);
+        el_handle_t h3 = el_halloc(80);
+        el_handle_t h4 = el_halloc(120);
+        strcpy(el_hpin(h3), "handle three");
+        el_hunpin(h3);
+        strcpy(el_hpin(h4), "handle four");   // stays pinned
+        el_hfree(h0);
+        printf("BEFORE COMPACT\n");
+        el_print_stats();
+
+        size_t moved = el_compact(0);
+        printf("\nAFTER COMPACT: moved %lu\n", moved);
+        el_print_stats();
+
+        el_hunpin(h4);
+        el_free(p2);
+        moved = el_compact(0);
+        printf("\nAFTER UNPIN/FREE/COMPACT: moved %lu\n", moved);
+        el_print_stats();
+        printf("h1 @ %p\n", el_hpin(h1));
+        printf("h3 @ %p: %s\n", el_hpin(h3), (char *) el_hpin(h3));
+        printf("h4 @ %p: %s\n", el_hpin(h4), (char *) el_hpin(h4));
+
+        el_hfree(h0);                       // already freed
+        el_hfree(EL_NO_HANDLE);
+        el_hunpin(EL_NO_HANDLE);
+        printf("\nPIN FREED: %p  PIN EL_NO_HANDLE: %p  PIN %d: %p\n",
+               el_hpin(h0), el_hpin(EL_NO_HANDLE), EL_MAX_HANDLES, el_hpin(EL_MAX_HANDLES));
+
+        el_cleanup();
+        el_init(HEAP_SIZE);
+        el_handle_t n0 = el_halloc(16);
+        el_handle_t n1 = el_halloc(16);
+        printf("\nAFTER CLEANUP: handles %ld %ld\n", n0, n1);
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Snapshot Restore") == 0) {
+        PRINT_TEST;
+        // Takes a snapshot of a heap with some used and available blocks,
+        // tears the heap down and restores it. The lists and data should
+        // match and the restored heap should keep working.
+
+        char *p0 = el_malloc(128);
+        strcpy(p0, "snapshot data");
+        void *p1 = el_malloc(200);
+        el_malloc(64);
+        el_free(p1);
+        printf("BEFORE SNAPSHOT\n");
+        el_print_stats();
+        el_snapshot("test-snapshot.dat");
+        el_cleanup();
+
+        el_restore("test-snapshot.dat");
+        unlink("test-snapshot.dat");
+        printf("\nAFTER RESTORE\n");
+        el_print_stats();
+        printf("p0 contents: %s\n", p0);
+
+        el_free(p0);
+        el_malloc(300);
+        printf("\nAFTER FREE/MALLOC\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Slab Allocation") == 0) {
+        PRINT_TEST;
+        // Enables the slab tier on a larger heap. Small allocations should
+        // come from page-aligned run blocks in the list heap, one per size
+        // class, while larger ones get blocks of their own. Freeing every slot should
+        // keep the emptied run for its class, and turning the tier off
+        // should return the runs to the list heap.
+
+        el_cleanup();
+        el_init_size(32768);
+        el_mallopt(EL_OPT_SLAB, 1);
+        void *ptr[16] = {};
+        int len = 0;
+        ptr[len++] = el_malloc(24);
+        ptr[len++] = el_malloc(32);
+        ptr[len++] = el_malloc(20);
+        ptr[len++] = el_malloc(200);
+        ptr[len++] = el_malloc(1000);
+        printf("AFTER MALLOCS\n");
+        el_print_stats();
+        printf("\nPOINTERS\n");
+        print_ptrs(ptr, len);
+
+        for (int i = 0; i < len; i++) {
+            el_free(ptr[i]);
+        }
+        printf("\nAFTER FREES\n");
+        el_print_stats();
+
+        el_mallopt(EL_OPT_SLAB, 0);
+        printf("\nSLAB TIER OFF\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Span Allocation") == 0) {
+        PRINT_TEST;
+        // Creates an 8 page span region. Medium allocations should take
+        // whole pages from it, best fitting span first, and freeing
+        // should coalesce neighbouring free spans back together. Once
+        // el_oom_purge() has given the free region back a new one can
+        // be set.
+
+        el_cleanup();
+        el_init_size(65536);
+        el_mallopt(EL_OPT_SPAN_PAGES, 8);
+        void *ptr[16] = {};
+        int len = 0;
+        ptr[len++] = el_malloc(3000);
+        ptr[len++] = el_malloc(9000);
+        ptr[len++] = el_malloc(5000);
+        ptr[len++] = el_malloc(100);
+        printf("AFTER MALLOCS\n");
+        el_print_spans();
+        printf("\nPOINTERS\n");
+        print_ptrs(ptr, len);
+
+        el_free(ptr[1]);
+        printf("\nFREE 1\n");
+        el_print_spans();
+
+        ptr[len++] = el_malloc(4096);
+        printf("\nMALLOC 4\n");
+        el_print_spans();
+        print_ptrs(ptr, len);
+
+        el_free(ptr[0]);
+        el_free(ptr[2]);
+        el_free(ptr[4]);
+        printf("\nFREE 0,2,4\n");
+        el_print_spans();
+
+        el_free(ptr[3]);
+        printf("\nPURGED: %d\n", el_oom_purge(0, NULL));
+        printf("SPAN PAGES RESTORED: %d\n", el_mallopt(EL_OPT_SPAN_PAGES, 8));
+        el_print_spans();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Aligned Tier Allocation") == 0) {
+        PRINT_TEST;
+        // Enables the tiny and slab tiers and a span region. Aligned
+        // requests whose rounded size lands in a tier should be served
+        // from it, the rest from aligned list blocks. After the frees
+        // each tier class used keeps its now empty page for reuse.
+
+        el_cleanup();
+        el_init_size(65536);
+        el_mallopt(EL_OPT_TINY, 1);
+        el_mallopt(EL_OPT_SLAB, 1);
+        el_mallopt(EL_OPT_SPAN_PAGES, 4);
+        size_t aligns[] = {8, 16, 32, 16, 64, 4096, 256};
+        size_t sizes[]  = {5, 20, 40, 100, 200, 3000, 600};
+        void *ptr[16] = {};
+        int len = 0;
+        for (int i = 0; i < 7; i++) {
+            ptr[len++] = el_memalign(aligns[i], sizes[i]);
+        }
+        printf("POINTERS\n");
+        print_ptrs(ptr, len);
+        printf("\nALIGNED\n");
+        for (int i = 0; i < len; i++) {
+            printf("ptr[%2d] %% %4lu: %lu\n", i, aligns[i], (size_t) ptr[i] % aligns[i]);
+        }
+
+        for (int i = 0; i < len; i++) {
+            el_free(ptr[i]);
+        }
+        printf("\nAFTER FREES\n");
+        el_print_spans();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Batch Allocation") == 0) {
+        PRINT_TEST;
+        // Allocates a batch of aligned blocks under one lock, as object
+        // caches do on refill, then asks for more than the heap holds
+        // to get a short batch, and frees both batches together.
+
+        el_cleanup();
+        el_init_size(4096);
+        void *ptr[64] = {};
+        int got = el_malloc_batch(16, 40, ptr, 6);
+        printf("FIRST BATCH: %d\n", got);
+        print_ptrs(ptr, got);
+        int more = el_malloc_batch(16, 1000, ptr + got, 10);
+        printf("\nSECOND BATCH: %d\n", more);
+        print_ptrs(ptr + got, more);
+        printf("\n");
+        el_print_stats();
+
+        el_free_batch(ptr, got + more);
+        printf("\nAFTER FREE BATCH\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Memory Budget") == 0) {
+        PRINT_TEST;
+        // Sets a soft and a hard byte budget. Crossing the soft limit
+        // runs the pressure callback, which frees a cached block;
+        // allocations that would cross the hard limit fail and are
+        // counted.
+
+        el_cleanup();
+        el_init_size(8192);
+        void *cache = NULL;
+        el_add_pressure_callback(shed_cache, &cache);
+        el_mallopt(EL_OPT_SOFT_LIMIT, 1500);
+        el_mallopt(EL_OPT_HARD_LIMIT, 2500);
+        void *ptr[16] = {};
+        int len = 0;
+        cache = el_malloc(600);
+        ptr[len++] = el_malloc(500);
+        printf("BELOW SOFT LIMIT\n");
+        el_print_budget();
+
+        ptr[len++] = el_malloc(700);
+        printf("\nPAST SOFT LIMIT\n");
+        el_print_budget();
+
+        ptr[len++] = el_malloc(1000);
+        ptr[len++] = el_malloc(400);
+        printf("\nAT HARD LIMIT\n");
+        el_print_budget();
+        printf("\nPOINTERS\n");
+        print_ptrs(ptr, len);
+
+        for (int i = 0; i < len; i++) {
+            if (ptr[i] != NULL) {
+                el_free(ptr[i]);
+            }
+        }
+        printf("\nAFTER FREES\n");
+        el_print_budget();
+
+        int local;
+        el_free(NULL);
+        el_free(&local);
+        printf("\nAFTER FREEING NULL AND A STACK POINTER\n");
+        el_print_budget();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "OOM Handlers") == 0) {
+        PRINT_TEST;
+        // Leaves the free space of a small heap split into two holes
+        // by handle blocks so a larger request fails. The handlers run
+        // in order until compaction merges the holes and the retried
+        // request succeeds.
+
+        el_cleanup();
+        el_init_size(4096);
+        el_add_oom_handler(el_oom_purge, NULL);
+        el_add_oom_handler(log_oom, "evict");
+        el_add_oom_handler(el_oom_compact, NULL);
+        el_add_oom_handler(log_oom, "never reached");
+        el_handle_t h[4];
+        for (int i = 0; i < 4; i++) {
+            h[i] = el_halloc(800);
+        }
+        el_hfree(h[0]);
+        el_hfree(h[2]);
+        printf("BEFORE\n");
+        el_print_stats();
+
+        void *ptr = el_malloc(1500);
+        printf("\nAFTER MALLOC\n");
+        print_ptr("ptr", ptr);
+        el_print_stats();
+        printf("runs: %lu  rescues: %lu\n", el_ctl.oom.runs, el_ctl.oom.rescues);
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Fork Safety") == 0) {
+        PRINT_TEST;
+        // Forks repeatedly while another thread allocates and frees.
+        // Each child must find the heap lock free and the lists intact
+        // and be able to allocate; a child inheriting a held lock would
+        // hang, so the children are given an alarm.
+
+        el_cleanup();
+        el_init_size(65536);
+        pthread_t thread;
+        pthread_create(&thread, NULL, churn, NULL);
+        int ok = 0;
+        for (int i = 0; i < 50; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                alarm(5);
+                void *p = el_malloc(1000);
+                el_free(p);
+                _exit(p == NULL ? 1 : 0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+            ok += WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        churn_stop = 1;
+        pthread_join(thread, NULL);
+        printf("children ok: %d of 50\n", ok);
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Real-Time Mode") == 0) {
+        PRINT_TEST;
+        // Switches to bounded-latency mode. Requests are served from
+        // the bins with a block certain to fit rather than the first
+        // that does, freeing still merges neighbours, and trimming is
+        // refused so no pages leave memory.
+
+        el_cleanup();
+        el_init_size(8192);
+        printf("REALTIME: %d\n", el_mallopt(EL_OPT_REALTIME, 1));
+        printf("SPANS REFUSED: %d\n", el_mallopt(EL_OPT_SPAN_PAGES, 1));
+        printf("SLAB TUNING REFUSED: %d\n", el_mallopt(EL_OPT_SLAB_TUNE, 64));
+        void *ptr[16] = {};
+        int len = 0;
+        ptr[len++] = el_malloc(100);
+        ptr[len++] = el_malloc(1000);
+        ptr[len++] = el_malloc(300);
+        ptr[len++] = el_malloc(2000);
+        el_free(ptr[1]);
+        el_free(ptr[3]);
+        ptr[len++] = el_malloc(500);
+        ptr[len++] = el_memalign(256, 200);
+        printf("POINTERS\n");
+        print_ptrs(ptr, len);
+        printf("\n");
+        el_print_stats();
+        printf("\nTRIMMED: %lu\n", el_trim());
+
+        el_free(ptr[0]);
+        el_free(ptr[2]);
+        el_free(ptr[4]);
+        el_free(ptr[5]);
+        printf("\nAFTER FREES\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Slab Tuning") == 0) {
+        PRINT_TEST;
+        // Serves 40- and 100-byte requests from the default slab
+        // classes, where they waste 24 and 28 bytes a slot, then lets
+        // the classes be re-derived from the observed sizes. The partly
+        // used 64-byte run is retired and drains as its blocks are freed.
+
+        el_cleanup();
+        el_init_size(1 << 20);
+        el_mallopt(EL_OPT_SLAB, 1);
+        el_mallopt(EL_OPT_SPAN_PAGES, 64);
+        el_print_slab_classes();
+
+        void *old[8] = {};
+        for (int i = 0; i < 8; i++) {
+            old[i] = el_malloc(40);
+        }
+        el_mallopt(EL_OPT_SLAB_TUNE, 64);
+        void *ptr[64] = {};
+        for (int i = 0; i < 64; i++) {
+            ptr[i] = el_malloc(i % 2 == 0 ? 40 : 100);
+        }
+        printf("\nAFTER 64 MALLOCS OF 40 AND 100 BYTES\n");
+        el_print_slab_classes();
+        print_ptr("new block", ptr[63]);
+
+        for (int i = 0; i < 8; i++) {
+            el_free(old[i]);
+        }
+        for (int i = 0; i < 64; i++) {
+            el_free(ptr[i]);
+        }
+        printf("\nAFTER FREES\n");
+        el_print_slab_classes();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Realloc") == 0) {
+        PRINT_TEST;
+        // Shrinks a block in place, grows it back into the space freed
+        // above it, then grows it past a used neighbour so that it
+        // moves. The contents survive each step.
+
+        el_cleanup();
+        el_init_size(4096);
+        char *p0 = el_malloc(200);
+        void *p1 = el_malloc(100);
+        for (int i = 0; i < 200; i++) {
+            p0[i] = 'a' + i % 26;
+        }
+
+        char *q = el_realloc(p0, 80);
+        printf("SHRINK TO 80: %s\n", q == p0 ? "in place" : "moved");
+        el_print_stats();
+
+        q = el_realloc(q, 150);
+        printf("\nGROW TO 150: %s\n", q == p0 ? "in place" : "moved");
+        el_print_stats();
+
+        q = el_realloc(q, 400);
+        printf("\nGROW TO 400: %s\n", q == p0 ? "in place" : "moved");
+        el_print_stats();
+        int same = 1;
+        for (int i = 0; i < 80; i++) {
+            same &= q[i] == 'a' + i % 26;
+        }
+        printf("\nfirst 80 bytes kept: %s\n", same ? "yes" : "no");
+
+        printf("realloc(NULL, 64): %s\n", (p0 = el_realloc(NULL, 64)) != NULL ? "allocated" : "NULL");
+        printf("realloc(p, 0): %s\n", el_realloc(p0, 0) == NULL ? "NULL" : "not NULL");
+        el_free(q);
+        el_free(p1);
+        printf("\nAFTER FREES\n");
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Resident Memory") == 0) {
+        PRINT_TEST;
+        // Fills a large block so its pages become resident, frees and
+        // trims it so they are released, then allocates it again: its
+        // pages stay released until they are written.
+
+        el_cleanup();
+        el_init_size(64 * 4096);
+        printf("FRESH HEAP\n");
+        el_print_resident();
+
+        char *small = el_malloc(100);
+        char *big = el_malloc(100000);
+        memset(small, 1, 100);
+        memset(big, 1, 100000);
+        printf("\nAFTER FILLING 100000 BYTES\n");
+        el_print_resident();
+
+        el_free(big);
+        printf("\nTRIMMED %lu BYTES\n", el_trim());
+        el_print_resident();
+
+        big = el_malloc(100000);
+        printf("\nALLOCATED AGAIN\n");
+        el_print_resident();
+
+        memset(big, 1, 100000);
+        printf("\nFILLED AGAIN\n");
+        el_print_resident();
+        el_free(big);
+        el_free(small);
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Shards") == 0) {
+        PRINT_TEST;
+        // Splits a heap into two shards. This thread prefers shard 0 and
+        // falls back to shard 1 once shard 0 is too full; a second
+        // thread prefers shard 1. Each block is freed back to the shard
+        // its address lies in.
+
+        el_cleanup();
+        el_init_size(4 * 4096);
+        printf("split into 17: %d\n", el_mallopt(EL_OPT_SHARDS, 17));
+        printf("split into 2: %d\n", el_mallopt(EL_OPT_SHARDS, 2));
+        el_print_shards();
+
+        void *p0 = el_malloc(3000);
+        void *p1 = el_malloc(6000);
+        printf("\n3000 BYTES IN SHARD 0, 6000 BYTES FALL BACK TO SHARD 1\n");
+        el_print_shards();
+
+        pthread_t thread;
+        void *p2 = NULL;
+        pthread_create(&thread, NULL, shard_thread, &p2);
+        pthread_join(thread, NULL);
+        printf("\nSECOND THREAD ALLOCATES 500 BYTES FROM SHARD 1\n");
+        el_print_shards();
+
+        el_free(p1);
+        el_free(p2);
+        el_free(p0);
+        printf("\nAFTER FREES\n");
+        el_print_shards();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Deferred Free") == 0) {
+        PRINT_TEST;
+        // Defers frees to a maintenance thread whose interval is too
+        // long for it to run during the test. Freed blocks stay on the
+        // used list marked pending until an allocation which cannot be
+        // served otherwise frees them itself.
+
+        el_cleanup();
+        el_init_size(4096);
+        printf("defer with a pass every 1000000 ms: %d\n", el_mallopt(EL_OPT_DEFER_FREE, 1000000));
+        void *p0 = el_malloc(1500);
+        void *p1 = el_malloc(1500);
+        el_free(p0);
+        el_free(p1);
+        printf("\nTWO BLOCKS FREED\n");
+        el_print_stats();
+        el_print_defer();
+
+        void *p2 = el_malloc(3000);
+        printf("\n3000 BYTES AFTER FREEING THE QUEUE: %s\n", p2 != NULL ? "allocated" : "NULL");
+        el_print_stats();
+        el_print_defer();
+
+        el_free(p2);
+        printf("\nSTOPPED: %d\n", el_mallopt(EL_OPT_DEFER_FREE, 0));
+        el_print_stats();
+        el_print_defer();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Free Buffer") == 0) {
+        PRINT_TEST;
+        // Buffers frees in batches of 4. The first three frees leave
+        // their blocks in use; the fourth frees all four together in
+        // address order. A partial buffer is flushed on request.
+
+        el_cleanup();
+        el_init_size(4096);
+        printf("buffer 300 frees: %d\n", el_mallopt(EL_OPT_FREE_BUFFER, 300));
+        printf("buffer 4 frees: %d\n", el_mallopt(EL_OPT_FREE_BUFFER, 4));
+        void *ptr[5];
+        for (int i = 0; i < 5; i++) {
+            ptr[i] = el_malloc(200);
+        }
+        el_free(ptr[3]);
+        el_free(ptr[0]);
+        el_free(ptr[2]);
+        printf("\nTHREE FREES BUFFERED\n");
+        el_print_stats();
+
+        el_free(ptr[1]);
+        printf("\nFOURTH FREE FLUSHES THE BUFFER\n");
+        el_print_stats();
+
+        el_free(ptr[4]);
+        printf("\nFLUSHED %d\n", el_free_flush());
+        el_print_stats();
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Usable Size") == 0) {
+        PRINT_TEST;
+        // Shows the slack a list block keeps when shrinking it leaves
+        // too little to split off, then compares el_good_size() with
+        // el_malloc_usable_size() of the block each request gets from
+        // every tier, and once the span region is full, which takes
+        // turning the tiers off so they give back the pages they keep.
+
+        el_cleanup();
+        el_init_size(64 * 4096);
+        void *p0 = el_malloc(200);
+        printf("200 BYTES: good size %lu  usable size %lu\n", el_good_size(200), el_malloc_usable_size(p0));
+        p0 = el_realloc(p0, 180);
+        printf("SHRUNK TO 180: usable size %lu\n", el_malloc_usable_size(p0));
+        p0 = el_realloc(p0, 100);
+        printf("SHRUNK TO 100: usable size %lu\n", el_malloc_usable_size(p0));
+        el_free(p0);
+
+        el_mallopt(EL_OPT_TINY, 1);
+        el_mallopt(EL_OPT_SLAB, 1);
+        el_mallopt(EL_OPT_SPAN_PAGES, 16);
+        printf("\nTIERS ENABLED\n");
+        size_t sizes[] = {1, 20, 65, 100, 1000, 1500, 3000, 5000};
+        for (int i = 0; i < 8; i++) {
+            void *p = el_malloc(sizes[i]);
+            printf("request %4lu: good size %5lu  usable size %5lu\n",
+                   sizes[i], el_good_size(sizes[i]), el_malloc_usable_size(p));
+            el_free(p);
+        }
+        el_mallopt(EL_OPT_TINY, 0);
+        el_mallopt(EL_OPT_SLAB, 0);
+        void *full = el_malloc(16 * 4096);
+        void *p = el_malloc(5000);
+        printf("\nSPAN REGION FULL\nrequest 5000: good size %5lu  usable size %5lu\n",
+               el_good_size(5000), el_malloc_usable_size(p));
+        el_free(p);
+        el_free(full);
+        int local;
+        printf("\nusable size of NULL: %lu  of a stack pointer: %lu\n",
+               el_malloc_usable_size(NULL), el_malloc_usable_size(&local));
+    } // ENDTEST
+
+    else if (strcmp(test_name, "Tier Fallback") == 0) {
+        PRINT_TEST;
+        // Enables the tiny and slab tiers on the default heap, which is
+        // too small to carve a page-aligned page or run from. Small
+        // requests should then come from the block lists as they do with
+        // the tiers off, and el_good_size() should not promise a slot.
+
+        el_mallopt(EL_OPT_TINY, 1);
+        el_mallopt(EL_OPT_SLAB, 1);
+        void *ptr[16] = {};
+        int len = 0;
+        ptr[len++] = el_malloc(100);
+        ptr[len++] = el_malloc(200);
+        ptr[len++] = el_malloc(16);
+        printf("POINTERS\n");
+        print_ptrs(ptr, len);
+        printf("\nrequest 100: good size %lu  usable size %lu\n",
+               el_good_size(100), el_malloc_usable_size(ptr[0]));
+        printf("request  16: good size %lu  usable size %lu\n",
+               el_good_size(16), el_malloc_usable_size(ptr[2]));
+        printf("\nAFTER MALLOCS\n");
+        el_print_stats();
+
+        for (int i = 0; i < len; i++) {
+            el_free(ptr[i]);
+        }
+        printf("\nAFTER FREES\n");
+        el_print_stats();
+    } // ENDTEST
+
     else {
         printf("No test named '%s' found\n",test_name);
         return 1;